@@ -0,0 +1,344 @@
+//
+// Bidirectional path tracing, following the structure of pbrt-v3's bdpt.cpp.
+//
+
+#include "BDPT.hpp"
+
+namespace {
+
+inline bool isBlack(const Vector3f &v) { return v.x == 0 && v.y == 0 && v.z == 0; }
+
+inline float remap0(float f) { return f != 0 ? f : 1; }
+
+}
+
+BDPTIntegrator::BDPTIntegrator(const Scene &scene, const Camera &camera, int maxDepth)
+    : maxDepth(maxDepth), scene(scene), camera(camera),
+      lightImage(camera.width * camera.height)
+{}
+
+Vector3f BDPTIntegrator::Li(const Ray &ray, Sampler &sampler) const
+{
+    thread_local std::vector<PathVertex> cameraPath, lightPath;
+    cameraPath.resize(maxDepth + 2);
+    lightPath.resize(maxDepth + 1);
+
+    int nCamera = generateCameraSubpath(ray, sampler, cameraPath.data());
+    int nLight = generateLightSubpath(sampler, lightPath.data());
+
+    Vector3f L;
+    for (int t = 1; t <= nCamera; ++t) {
+        for (int s = 0; s <= nLight; ++s) {
+            int depth = t + s - 2;
+            if ((s == 1 && t == 1) || depth < 0 || depth > maxDepth)
+                continue;
+            Vector2f raster;
+            Vector3f Lpath = connect(lightPath.data(), cameraPath.data(), s, t, sampler, raster);
+            if (t != 1)
+                L += Lpath;
+            else if (!isBlack(Lpath))
+                splat(raster, Lpath);
+        }
+    }
+    return L;
+}
+
+bool BDPTIntegrator::finish(std::vector<Vector3f> &framebuffer, int spp) const
+{
+    // one light subpath was traced per camera sample
+    for (size_t i = 0; i < framebuffer.size(); ++i)
+        framebuffer[i] += lightImage[i] / spp;
+    return true;
+}
+
+int BDPTIntegrator::generateCameraSubpath(const Ray &ray, Sampler &sampler, PathVertex *path) const
+{
+    PathVertex &v = path[0];
+    v = PathVertex();
+    v.type = PathVertex::Type::Camera;
+    v.p = camera.eye;
+    v.beta = Vector3f(1.0f);
+    float pdfDir = camera.pdfDirection(ray.direction);
+    return randomWalk(ray, sampler, v.beta, pdfDir, maxDepth + 1, path + 1) + 1;
+}
+
+int BDPTIntegrator::generateLightSubpath(Sampler &sampler, PathVertex *path) const
+{
+    Intersection pos;
+    float pdfPos = 0.0f;
+    scene.sampleLight(pos, pdfPos, sampler.get2D());
+    Vector2f u = sampler.get2D();
+    if (pdfPos <= 0.0f)
+        return 0;
+
+    // cosine-weighted emission around the light normal
+    Frame frame(pos.normal);
+    float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+    float cosTheta = std::sqrt(std::max(0.0f, 1.0f - u.x));
+    float pdfDir = cosTheta / M_PI;
+    if (pdfDir <= 0.0f)
+        return 0;
+    Vector3f dir = frame.toWorld(Vector3f(r * std::cos(phi), r * std::sin(phi), cosTheta));
+
+    PathVertex &v = path[0];
+    v = PathVertex();
+    v.type = PathVertex::Type::Light;
+    v.p = pos.coords;
+    v.n = pos.normal;
+    v.Le = pos.emit;
+    v.beta = pos.emit / pdfPos;
+    v.pdfFwd = pdfPos;
+
+    Vector3f beta = pos.emit * (cosTheta / (pdfPos * pdfDir));
+    return randomWalk(Ray(pos.coords, dir), sampler, beta, pdfDir, maxDepth, path + 1) + 1;
+}
+
+int BDPTIntegrator::randomWalk(Ray ray, Sampler &sampler, Vector3f beta, float pdf, int maxBounces,
+                               PathVertex *path) const
+{
+    if (maxBounces == 0)
+        return 0;
+    int bounces = 0;
+    float pdfFwd = pdf, pdfRev = 0.0f;
+    while (true) {
+        Intersection isect = scene.intersect(ray);
+        if (!isect.happened)
+            break;
+
+        PathVertex &vertex = path[bounces], &prev = path[bounces - 1];
+        vertex = PathVertex();
+        vertex.p = isect.coords;
+        vertex.n = isect.normal;
+        vertex.wo = -ray.direction;
+        vertex.m = isect.m;
+        vertex.frame = Frame(isect.normal);
+        vertex.beta = beta;
+        vertex.pdfFwd = convertDensity(prev, pdfFwd, vertex);
+        if (++bounces >= maxBounces)
+            break;
+
+        BSDFSample bs = vertex.m->sample(ray.direction, vertex.frame, sampler.get2D());
+        if (bs.pdf <= 0.0f)
+            break;
+        beta *= bs.weight;
+        pdfFwd = bs.pdf;
+        if (bs.isDelta) {
+            vertex.delta = true;
+            pdfFwd = pdfRev = 0.0f;
+        }
+        else {
+            pdfRev = vertex.m->pdf(-bs.wo, vertex.wo, vertex.frame);
+        }
+        prev.pdfRev = convertDensity(vertex, pdfRev, prev);
+        ray = Ray(vertex.p, bs.wo);
+    }
+    return bounces;
+}
+
+Vector3f BDPTIntegrator::connect(PathVertex *lightPath, PathVertex *cameraPath, int s, int t,
+                                 Sampler &sampler, Vector2f &raster) const
+{
+    Vector3f L;
+    PathVertex sampled;
+    if (s == 0) {
+        // the camera subpath hit an emitter on its own
+        const PathVertex &pt = cameraPath[t - 1];
+        if (pt.type == PathVertex::Type::Surface && pt.isLight() && dotProduct(pt.n, pt.wo) > 0.0f)
+            L = pt.m->getEmission() * pt.beta;
+    }
+    else if (t == 1) {
+        // light tracing: connect the light subpath to the eye
+        const PathVertex &qs = lightPath[s - 1];
+        if (qs.connectible() && camera.rasterPosition(qs.p, raster)) {
+            Vector3f toCam = camera.eye - qs.p;
+            float dist2 = dotProduct(toCam, toCam);
+            Vector3f dir = toCam / std::sqrt(dist2);
+            float We = camera.importance(-dir);
+            if (We > 0.0f) {
+                sampled.type = PathVertex::Type::Camera;
+                sampled.p = camera.eye;
+                sampled.beta = Vector3f(We * -dir.z / dist2);
+                L = qs.beta * f(qs, sampled) * sampled.beta * std::fabs(dotProduct(dir, qs.n));
+                if (!isBlack(L) && !scene.visible(qs.p, camera.eye))
+                    L = Vector3f(0.0f);
+            }
+        }
+    }
+    else if (s == 1) {
+        // next event estimation from the camera subpath
+        const PathVertex &pt = cameraPath[t - 1];
+        if (pt.connectible()) {
+            Intersection pos;
+            float pdfPos = 0.0f;
+            scene.sampleLight(pos, pdfPos, sampler.get2D());
+            Vector3f wi = pos.coords - pt.p;
+            float dist2 = dotProduct(wi, wi);
+            wi = wi / std::sqrt(dist2);
+            float cosLight = dotProduct(-wi, pos.normal);
+            if (pdfPos > 0.0f && cosLight > 0.0f) {
+                sampled.type = PathVertex::Type::Light;
+                sampled.p = pos.coords;
+                sampled.n = pos.normal;
+                sampled.Le = pos.emit;
+                sampled.beta = pos.emit / (pdfPos * dist2 / cosLight);
+                sampled.pdfFwd = pdfPos;
+                L = pt.beta * f(pt, sampled) * sampled.beta * std::fabs(dotProduct(wi, pt.n));
+                if (!isBlack(L) && !scene.visible(pt.p, pos.coords))
+                    L = Vector3f(0.0f);
+            }
+        }
+    }
+    else {
+        const PathVertex &qs = lightPath[s - 1], &pt = cameraPath[t - 1];
+        if (qs.connectible() && pt.connectible()) {
+            L = qs.beta * f(qs, pt) * f(pt, qs) * pt.beta;
+            if (!isBlack(L))
+                L *= G(qs, pt);
+        }
+    }
+
+    if (isBlack(L))
+        return L;
+    return L * misWeight(lightPath, cameraPath, sampled, s, t);
+}
+
+float BDPTIntegrator::misWeight(PathVertex *lightPath, PathVertex *cameraPath, PathVertex &sampled,
+                                int s, int t) const
+{
+    if (s + t == 2)
+        return 1.0f;
+
+    PathVertex *qs = s > 0 ? &lightPath[s - 1] : nullptr;
+    PathVertex *pt = t > 0 ? &cameraPath[t - 1] : nullptr;
+    PathVertex *qsMinus = s > 1 ? &lightPath[s - 2] : nullptr;
+    PathVertex *ptMinus = t > 1 ? &cameraPath[t - 2] : nullptr;
+
+    // Temporarily rewrite the endpoints as if this connection had been
+    // sampled; everything is restored before returning.
+    PathVertex *replaced = s == 1 ? qs : (t == 1 ? pt : nullptr);
+    PathVertex savedEndpoint;
+    if (replaced) {
+        savedEndpoint = *replaced;
+        *replaced = sampled;
+    }
+    bool ptDelta = pt ? pt->delta : false, qsDelta = qs ? qs->delta : false;
+    float ptRev = pt ? pt->pdfRev : 0, ptMinusRev = ptMinus ? ptMinus->pdfRev : 0;
+    float qsRev = qs ? qs->pdfRev : 0, qsMinusRev = qsMinus ? qsMinus->pdfRev : 0;
+
+    if (pt) pt->delta = false;
+    if (qs) qs->delta = false;
+    if (pt) pt->pdfRev = s > 0 ? pdf(*qs, qsMinus, *pt) : pdfLightOrigin(*pt);
+    if (ptMinus) ptMinus->pdfRev = s > 0 ? pdf(*pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus);
+    if (qs) qs->pdfRev = pdf(*pt, ptMinus, *qs);
+    if (qsMinus) qsMinus->pdfRev = pdf(*qs, pt, *qsMinus);
+
+    float sumRi = 0.0f, ri = 1.0f;
+    for (int i = t - 1; i > 0; --i) {
+        ri *= remap0(cameraPath[i].pdfRev) / remap0(cameraPath[i].pdfFwd);
+        if (!cameraPath[i].delta && !cameraPath[i - 1].delta)
+            sumRi += ri * ri;
+    }
+    ri = 1.0f;
+    for (int i = s - 1; i >= 0; --i) {
+        ri *= remap0(lightPath[i].pdfRev) / remap0(lightPath[i].pdfFwd);
+        bool deltaLightVertex = i > 0 ? lightPath[i - 1].delta : false;
+        if (!lightPath[i].delta && !deltaLightVertex)
+            sumRi += ri * ri;
+    }
+
+    if (pt) { pt->delta = ptDelta; pt->pdfRev = ptRev; }
+    if (qs) { qs->delta = qsDelta; qs->pdfRev = qsRev; }
+    if (ptMinus) ptMinus->pdfRev = ptMinusRev;
+    if (qsMinus) qsMinus->pdfRev = qsMinusRev;
+    if (replaced) *replaced = savedEndpoint;
+
+    return 1.0f / (1.0f + sumRi);
+}
+
+Vector3f BDPTIntegrator::f(const PathVertex &v, const PathVertex &next) const
+{
+    if (v.type != PathVertex::Type::Surface)
+        return Vector3f(0.0f);
+    Vector3f wi = normalize(next.p - v.p);
+    return v.m->eval(-v.wo, wi, v.frame);
+}
+
+float BDPTIntegrator::pdf(const PathVertex &v, const PathVertex *prev, const PathVertex &next) const
+{
+    if (v.type == PathVertex::Type::Light)
+        return pdfLight(v, next);
+    Vector3f wn = next.p - v.p;
+    if (dotProduct(wn, wn) == 0)
+        return 0.0f;
+    wn = normalize(wn);
+    float pdfDir;
+    if (v.type == PathVertex::Type::Camera)
+        pdfDir = camera.pdfDirection(wn);
+    else
+        pdfDir = v.m->pdf(-normalize(prev->p - v.p), wn, v.frame);
+    return convertDensity(v, pdfDir, next);
+}
+
+float BDPTIntegrator::pdfLight(const PathVertex &v, const PathVertex &next) const
+{
+    // density of the cosine-weighted emission sampling, as area density at next
+    Vector3f w = next.p - v.p;
+    float dist2 = dotProduct(w, w);
+    if (dist2 == 0)
+        return 0.0f;
+    w = w / std::sqrt(dist2);
+    float cosLight = dotProduct(v.n, w);
+    if (cosLight <= 0.0f)
+        return 0.0f;
+    float pdf = cosLight / M_PI / dist2;
+    if (next.onSurface())
+        pdf *= std::fabs(dotProduct(next.n, w));
+    return pdf;
+}
+
+float BDPTIntegrator::pdfLightOrigin(const PathVertex &v) const
+{
+    if (!v.isLight())
+        return 0.0f;
+    Intersection hit;
+    hit.coords = v.p;
+    hit.normal = v.n;
+    return scene.pdfLight(hit);
+}
+
+float BDPTIntegrator::convertDensity(const PathVertex &v, float pdf, const PathVertex &next) const
+{
+    Vector3f w = next.p - v.p;
+    float dist2 = dotProduct(w, w);
+    if (dist2 == 0)
+        return 0.0f;
+    float invDist2 = 1.0f / dist2;
+    if (next.onSurface())
+        pdf *= std::fabs(dotProduct(next.n, w * std::sqrt(invDist2)));
+    return pdf * invDist2;
+}
+
+float BDPTIntegrator::G(const PathVertex &a, const PathVertex &b) const
+{
+    Vector3f d = a.p - b.p;
+    float g = 1.0f / dotProduct(d, d);
+    d = d * std::sqrt(g);
+    if (a.onSurface())
+        g *= std::fabs(dotProduct(a.n, d));
+    if (b.onSurface())
+        g *= std::fabs(dotProduct(b.n, d));
+    return scene.visible(b.p, a.p) ? g : 0.0f;
+}
+
+void BDPTIntegrator::splat(const Vector2f &raster, const Vector3f &L) const
+{
+    int x = std::min(camera.width - 1, std::max(0, (int)raster.x));
+    int y = std::min(camera.height - 1, std::max(0, (int)raster.y));
+    Vector3f &pixel = lightImage[y * camera.width + x];
+    #pragma omp atomic
+    pixel.x += L.x;
+    #pragma omp atomic
+    pixel.y += L.y;
+    #pragma omp atomic
+    pixel.z += L.z;
+}
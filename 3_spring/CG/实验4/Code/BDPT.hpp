@@ -0,0 +1,65 @@
+//
+// Bidirectional path tracing: a camera subpath and a light subpath are
+// traced per pixel sample and every pair of their vertices is connected,
+// with each strategy weighted by the power heuristic over all strategies
+// that could have produced the same path (Veach 1997, Ch. 10).
+//
+
+#ifndef RAYTRACING_BDPT_H
+#define RAYTRACING_BDPT_H
+
+#include <vector>
+#include "Integrator.hpp"
+
+struct PathVertex
+{
+    enum class Type { Camera, Light, Surface };
+
+    Type type = Type::Surface;
+    Vector3f p;
+    Vector3f n;          // geometric normal; unused for the camera
+    Vector3f wo;         // unit direction towards the previous vertex
+    Vector3f beta;       // throughput up to and including this vertex
+    Material *m = nullptr;
+    Frame frame;
+    Vector3f Le;         // emission of a light vertex
+    bool delta = false;
+    float pdfFwd = 0.0f, pdfRev = 0.0f; // area densities
+
+    bool onSurface() const { return type != Type::Camera; }
+    bool isLight() const { return type == Type::Light || (m && m->hasEmission()); }
+    bool connectible() const { return type != Type::Surface || !delta; }
+};
+
+class BDPTIntegrator : public Integrator
+{
+public:
+    BDPTIntegrator(const Scene &scene, const Camera &camera, int maxDepth = 10);
+
+    Vector3f Li(const Ray &ray, Sampler &sampler) const override;
+    bool finish(std::vector<Vector3f> &framebuffer, int spp) const override;
+
+    int maxDepth;
+
+private:
+    int generateCameraSubpath(const Ray &ray, Sampler &sampler, PathVertex *path) const;
+    int generateLightSubpath(Sampler &sampler, PathVertex *path) const;
+    int randomWalk(Ray ray, Sampler &sampler, Vector3f beta, float pdf, int maxBounces, PathVertex *path) const;
+    Vector3f connect(PathVertex *light, PathVertex *camera, int s, int t, Sampler &sampler, Vector2f &raster) const;
+    float misWeight(PathVertex *light, PathVertex *camera, PathVertex &sampled, int s, int t) const;
+
+    Vector3f f(const PathVertex &v, const PathVertex &next) const;
+    float pdf(const PathVertex &v, const PathVertex *prev, const PathVertex &next) const;
+    float pdfLight(const PathVertex &v, const PathVertex &next) const;
+    float pdfLightOrigin(const PathVertex &v) const;
+    float convertDensity(const PathVertex &v, float pdf, const PathVertex &next) const;
+    float G(const PathVertex &a, const PathVertex &b) const;
+    void splat(const Vector2f &raster, const Vector3f &L) const;
+
+    const Scene &scene;
+    const Camera &camera;
+    // light-tracing (t = 1) contributions land on arbitrary pixels
+    mutable std::vector<Vector3f> lightImage;
+};
+
+#endif //RAYTRACING_BDPT_H
@@ -1,18 +1,29 @@
 #include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <unordered_map>
 #include "BVH.hpp"
+#include "Sampler.hpp"
+#include "TraversalStats.hpp"
+#include "Profiler.hpp"
 
 BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
                    SplitMethod splitMethod)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)), splitMethod(splitMethod),
       primitives(std::move(p))
 {
+    PROFILE_ZONE("BVH build");
     time_t start, stop;
     time(&start);
     if (primitives.empty())
         return;
 
-    root = recursiveBuild(primitives);
+    root = buildTree();
+    builtCost = sahCost();
+    flatten(defaultLayout);
 
     time(&stop);
     double diff = difftime(stop, start);
@@ -25,7 +36,350 @@ BVHAccel::BVHAccel(std::vector<Object*> p, int maxPrimsInNode,
         hrs, mins, secs);
 }
 
-BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
+// Object-median split along the axis of largest centroid extent.
+static void splitObjects(std::vector<Object*> &objects, std::vector<Object*> &leftshapes,
+                         std::vector<Object*> &rightshapes)
+{
+    Bounds3 centroidBounds;
+    for (int i = 0; i < objects.size(); ++i)
+        centroidBounds =
+            Union(centroidBounds, objects[i]->getBounds().Centroid());
+    int dim = centroidBounds.maxExtent();
+    switch (dim) {
+    case 0:
+        std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+            return f1->getBounds().Centroid().x <
+                   f2->getBounds().Centroid().x;
+        });
+        break;
+    case 1:
+        std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+            return f1->getBounds().Centroid().y <
+                   f2->getBounds().Centroid().y;
+        });
+        break;
+    case 2:
+        std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
+            return f1->getBounds().Centroid().z <
+                   f2->getBounds().Centroid().z;
+        });
+        break;
+    }
+
+    auto beginning = objects.begin();
+    auto middling = objects.begin() + (objects.size() / 2);
+    auto ending = objects.end();
+
+    leftshapes = std::vector<Object*>(beginning, middling);
+    rightshapes = std::vector<Object*>(middling, ending);
+
+    assert(objects.size() == (leftshapes.size() + rightshapes.size()));
+}
+
+namespace {
+
+// A primitive, or the part of it inside the bounds of a spatial split.
+struct Reference {
+    Object *object;
+    Bounds3 box;
+};
+
+bool isEmpty(const Bounds3 &b)
+{
+    return b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z;
+}
+
+double surfaceArea(const Bounds3 &b)
+{
+    return isEmpty(b) ? 0 : b.SurfaceArea();
+}
+
+// empty if they do not overlap, unlike Bounds3::Intersect
+Bounds3 overlap(const Bounds3 &a, const Bounds3 &b)
+{
+    Bounds3 o;
+    o.pMin = Vector3f::Max(a.pMin, b.pMin);
+    o.pMax = Vector3f::Min(a.pMax, b.pMax);
+    return o;
+}
+
+float centroid(const Bounds3 &b, int axis)
+{
+    return 0.5f * (b.pMin[axis] + b.pMax[axis]);
+}
+
+struct Split {
+    double cost = std::numeric_limits<double>::infinity();
+    int axis = -1, bin = 0;
+    // object splits: centroid range binned; spatial splits: the plane
+    float lo = 0, extent = 0, plane = 0;
+    Bounds3 left, right;
+};
+
+// Binned SBVH builder. Each node takes the cheaper (by SAH) of the best
+// object split and, when the object split's children overlap noticeably,
+// the best spatial split, as long as the duplicates fit the budget.
+class SpatialSplitBuilder
+{
+public:
+    explicit SpatialSplitBuilder(long budget) : budget(budget) {}
+
+    BVHBuildNode *build(const std::vector<Object*> &objects)
+    {
+        std::vector<Reference> refs;
+        Bounds3 bounds;
+        for (Object *object : objects) {
+            refs.push_back({ object, object->getBounds() });
+            bounds = Union(bounds, refs.back().box);
+        }
+        minOverlap = 1e-5 * surfaceArea(bounds);
+        BVHBuildNode *root = build(refs, bounds);
+        countReferences(root);
+        finish(root);
+        printf(" - SBVH: %ld references to %zu primitives\n", references, objects.size());
+        return root;
+    }
+
+private:
+    static constexpr int kBins = 32;
+
+    BVHBuildNode *build(std::vector<Reference> &refs, const Bounds3 &bounds)
+    {
+        BVHBuildNode *node = new BVHBuildNode();
+        node->bounds = bounds;
+        if (refs.size() == 1) {
+            node->object = refs[0].object;
+            ++references;
+            return node;
+        }
+
+        std::vector<Reference> left, right;
+        Split object = objectSplit(refs);
+        bool spatial = false;
+        if (budget > 0 && object.axis >= 0 && surfaceArea(overlap(object.left, object.right)) > minOverlap) {
+            Split split = spatialSplit(refs, bounds);
+            spatial = split.cost < object.cost && partitionSpatial(refs, split, left, right);
+        }
+        if (!spatial) {
+            left.clear(), right.clear();
+            if (object.axis >= 0)
+                for (const Reference &r : refs)
+                    (binOf(centroid(r.box, object.axis), object.lo, object.extent) <= object.bin ? left : right)
+                        .push_back(r);
+            else {
+                // all centroids coincide
+                left.assign(refs.begin(), refs.begin() + refs.size() / 2);
+                right.assign(refs.begin() + refs.size() / 2, refs.end());
+            }
+        }
+        std::vector<Reference>().swap(refs);
+
+        Bounds3 leftBounds, rightBounds;
+        for (const Reference &r : left)
+            leftBounds = Union(leftBounds, r.box);
+        for (const Reference &r : right)
+            rightBounds = Union(rightBounds, r.box);
+        node->left = build(left, leftBounds);
+        node->right = build(right, rightBounds);
+        return node;
+    }
+
+    static int binOf(float x, float lo, float extent)
+    {
+        return std::min(kBins - 1, std::max(0, (int)(kBins * (x - lo) / extent)));
+    }
+
+    // SAH over kBins centroid bins on each axis.
+    Split objectSplit(const std::vector<Reference> &refs) const
+    {
+        Bounds3 centroids;
+        for (const Reference &r : refs)
+            centroids = Union(centroids, (r.box.pMin + r.box.pMax) * 0.5f);
+        Split best;
+        for (int axis = 0; axis < 3; ++axis) {
+            float lo = centroids.pMin[axis], extent = centroids.pMax[axis] - lo;
+            if (!(extent > 0))
+                continue;
+            Bounds3 bins[kBins];
+            int counts[kBins] = {};
+            for (const Reference &r : refs) {
+                int b = binOf(centroid(r.box, axis), lo, extent);
+                bins[b] = Union(bins[b], r.box);
+                ++counts[b];
+            }
+            sweep(bins, counts, counts, axis, best, [&](Split &s, int bin) {
+                s.lo = lo, s.extent = extent;
+            });
+        }
+        return best;
+    }
+
+    // SAH over kBins planes on each axis; references spanning several bins
+    // are clipped to each of them.
+    Split spatialSplit(const std::vector<Reference> &refs, const Bounds3 &bounds) const
+    {
+        Split best;
+        for (int axis = 0; axis < 3; ++axis) {
+            float lo = bounds.pMin[axis], extent = bounds.pMax[axis] - lo;
+            if (!(extent > 0))
+                continue;
+            float width = extent / kBins;
+            Bounds3 bins[kBins];
+            int enter[kBins] = {}, exit[kBins] = {};
+            for (const Reference &r : refs) {
+                int first = binOf(r.box.pMin[axis], lo, extent), last = binOf(r.box.pMax[axis], lo, extent);
+                if (first == last)
+                    bins[first] = Union(bins[first], r.box);
+                else
+                    for (int b = first; b <= last; ++b) {
+                        Bounds3 slab = r.box;
+                        slab.pMin[axis] = std::max(slab.pMin[axis], lo + b * width);
+                        slab.pMax[axis] = std::min(slab.pMax[axis], b == kBins - 1 ? (float)bounds.pMax[axis] : lo + (b + 1) * width);
+                        Bounds3 clipped = r.object->clipBounds(slab);
+                        if (!isEmpty(clipped))
+                            bins[b] = Union(bins[b], clipped);
+                    }
+                ++enter[first];
+                ++exit[last];
+            }
+            sweep(bins, enter, exit, axis, best, [&](Split &s, int bin) {
+                s.plane = lo + (bin + 1) * width;
+            });
+        }
+        return best;
+    }
+
+    // Evaluates the kBins - 1 planes between bins; leftCounts are added up
+    // from the left, rightCounts from the right.
+    template <typename Fill>
+    static void sweep(const Bounds3 *bins, const int *leftCounts, const int *rightCounts, int axis, Split &best,
+                      Fill fill)
+    {
+        Bounds3 rightBoxes[kBins];
+        int rightN[kBins];
+        Bounds3 box;
+        int n = 0;
+        for (int b = kBins - 1; b > 0; --b) {
+            box = Union(box, bins[b]);
+            n += rightCounts[b];
+            rightBoxes[b] = box, rightN[b] = n;
+        }
+        box = Bounds3(), n = 0;
+        for (int b = 0; b < kBins - 1; ++b) {
+            box = Union(box, bins[b]);
+            n += leftCounts[b];
+            if (n == 0 || rightN[b + 1] == 0)
+                continue;
+            double cost = surfaceArea(box) * n + surfaceArea(rightBoxes[b + 1]) * rightN[b + 1];
+            if (cost < best.cost) {
+                best.cost = cost, best.axis = axis, best.bin = b;
+                best.left = box, best.right = rightBoxes[b + 1];
+                fill(best, b);
+            }
+        }
+    }
+
+    // Sends each reference to the side(s) of the plane it reaches; false
+    // (and nothing changed) if that does not shrink both sides or exceeds
+    // the duplication budget.
+    bool partitionSpatial(const std::vector<Reference> &refs, const Split &split, std::vector<Reference> &left,
+                          std::vector<Reference> &right)
+    {
+        int axis = split.axis;
+        for (const Reference &r : refs) {
+            if (r.box.pMax[axis] <= split.plane)
+                left.push_back(r);
+            else if (r.box.pMin[axis] >= split.plane)
+                right.push_back(r);
+            else {
+                Bounds3 l = r.box, rr = r.box;
+                l.pMax[axis] = split.plane;
+                rr.pMin[axis] = split.plane;
+                l = r.object->clipBounds(l);
+                rr = r.object->clipBounds(rr);
+                if (!isEmpty(l))
+                    left.push_back({ r.object, l });
+                if (!isEmpty(rr) || isEmpty(l))
+                    right.push_back({ r.object, isEmpty(rr) ? r.box : rr });
+            }
+        }
+        long duplicates = (long)(left.size() + right.size() - refs.size());
+        if (left.size() == refs.size() || right.size() == refs.size() || duplicates > budget)
+            return false;
+        budget -= duplicates;
+        return true;
+    }
+
+    void countReferences(BVHBuildNode *node)
+    {
+        if (node->object)
+            ++counts[node->object];
+        else {
+            countReferences(node->left);
+            countReferences(node->right);
+        }
+    }
+
+    void finish(BVHBuildNode *node)
+    {
+        if (node->object) {
+            node->references = counts[node->object];
+            node->area = node->object->getArea() / node->references;
+            return;
+        }
+        finish(node->left);
+        finish(node->right);
+        node->area = node->left->area + node->right->area;
+    }
+
+    long budget, references = 0;
+    double minOverlap = 0;
+    std::unordered_map<Object*, int> counts;
+};
+
+}
+
+BVHBuildNode* BVHAccel::buildTree()
+{
+    if (splitMethod == SplitMethod::SBVH)
+        return SpatialSplitBuilder((long)(spatialSplitBudget * primitives.size())).build(primitives);
+    BVHBuildNode* node = buildNode(primitives);
+    // ranges at or below the threshold are built eagerly, so only a lazy
+    // root leaves work for later
+    hasLazyNodes = node && node->lazy;
+    return node;
+}
+
+BVHBuildNode* BVHAccel::buildNode(std::vector<Object*> objects) const
+{
+    // lazy nodes always take the multi-object branch of recursiveBuild
+    if (lazyBuildThreshold <= 0 || objects.size() <= (size_t)std::max(2, lazyBuildThreshold))
+        return recursiveBuild(std::move(objects));
+    BVHBuildNode* node = new BVHBuildNode();
+    node->area = 0;
+    for (Object *object : objects) {
+        node->bounds = Union(node->bounds, object->getBounds());
+        node->area += object->getArea();
+    }
+    node->lazy = new BVHLazyRange();
+    node->lazy->objects = std::move(objects);
+    return node;
+}
+
+void BVHAccel::expand(BVHBuildNode* node) const
+{
+    std::call_once(node->lazy->once, [&] {
+        PROFILE_ZONE("BVH lazy split");
+        std::vector<Object*> leftshapes, rightshapes;
+        splitObjects(node->lazy->objects, leftshapes, rightshapes);
+        node->left = buildNode(std::move(leftshapes));
+        node->right = buildNode(std::move(rightshapes));
+        std::vector<Object*>().swap(node->lazy->objects);
+        node->lazy->built.store(true, std::memory_order_release);
+    });
+}
+
+BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects) const
 {
     BVHBuildNode* node = new BVHBuildNode();
 
@@ -51,40 +405,8 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
         return node;
     }
     else {
-        Bounds3 centroidBounds;
-        for (int i = 0; i < objects.size(); ++i)
-            centroidBounds =
-                Union(centroidBounds, objects[i]->getBounds().Centroid());
-        int dim = centroidBounds.maxExtent();
-        switch (dim) {
-        case 0:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().x <
-                       f2->getBounds().Centroid().x;
-            });
-            break;
-        case 1:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().y <
-                       f2->getBounds().Centroid().y;
-            });
-            break;
-        case 2:
-            std::sort(objects.begin(), objects.end(), [](auto f1, auto f2) {
-                return f1->getBounds().Centroid().z <
-                       f2->getBounds().Centroid().z;
-            });
-            break;
-        }
-
-        auto beginning = objects.begin();
-        auto middling = objects.begin() + (objects.size() / 2);
-        auto ending = objects.end();
-
-        auto leftshapes = std::vector<Object*>(beginning, middling);
-        auto rightshapes = std::vector<Object*>(middling, ending);
-
-        assert(objects.size() == (leftshapes.size() + rightshapes.size()));
+        std::vector<Object*> leftshapes, rightshapes;
+        splitObjects(objects, leftshapes, rightshapes);
 
         node->left = recursiveBuild(leftshapes);
         node->right = recursiveBuild(rightshapes);
@@ -96,15 +418,373 @@ BVHBuildNode* BVHAccel::recursiveBuild(std::vector<Object*> objects)
     return node;
 }
 
+static void freeNodes(BVHBuildNode *node)
+{
+    if (!node)
+        return;
+    freeNodes(node->left);
+    freeNodes(node->right);
+    delete node;
+}
+
+BVHAccel::~BVHAccel() { freeNodes(root); }
+
+// Subtrees near the root are refit as OpenMP tasks; deeper ones are too
+// small to be worth a task each.
+static void refitNode(BVHBuildNode *node, int depth)
+{
+    if (!node->ready()) {
+        // not split yet; the split will see the moved primitives
+        node->bounds = Bounds3();
+        node->area = 0;
+        for (Object *object : node->lazy->objects) {
+            node->bounds = Union(node->bounds, object->getBounds());
+            node->area += object->getArea();
+        }
+        return;
+    }
+    if (!node->left && !node->right) {
+        // full bounds: SBVH leaves lose their clipping but stay correct
+        node->bounds = node->object->getBounds();
+        node->area = node->object->getArea() / node->references;
+        return;
+    }
+    if (depth < 10) {
+        #pragma omp task
+        refitNode(node->left, depth + 1);
+        refitNode(node->right, depth + 1);
+        #pragma omp taskwait
+    }
+    else {
+        refitNode(node->left, depth + 1);
+        refitNode(node->right, depth + 1);
+    }
+    node->bounds = Union(node->left->bounds, node->right->bounds);
+    node->area = node->left->area + node->right->area;
+}
+
+bool BVHAccel::refit(float rebuildRatio)
+{
+    PROFILE_ZONE("BVH refit");
+    if (!root)
+        return false;
+    #pragma omp parallel
+    #pragma omp single
+    refitNode(root, 0);
+
+    // a lazy tree's cost grows as it is split, so it is never compared
+    bool rebuild = rebuildRatio > 0 && !hasLazyNodes && sahCost() > rebuildRatio * builtCost;
+    if (rebuild) {
+        PROFILE_ZONE("BVH rebuild");
+        freeNodes(root);
+        root = buildTree();
+        builtCost = sahCost();
+    }
+    if (layout != NodeLayout::Pointer)
+        flatten(layout);
+    return rebuild;
+}
+
+static double surfaceAreaSum(const BVHBuildNode *node)
+{
+    if (!node)
+        return 0;
+    return node->bounds.SurfaceArea() + surfaceAreaSum(node->left) + surfaceAreaSum(node->right);
+}
+
+float BVHAccel::sahCost() const
+{
+    double rootArea = root ? root->bounds.SurfaceArea() : 0;
+    return rootArea > 0 ? surfaceAreaSum(root) / rootArea : 0;
+}
+
+Bounds3 BVHAccel::WorldBound() const
+{
+    return root ? root->bounds : Bounds3();
+}
+
+namespace {
+
+// Sibling pairs in treelet order: pair 0 holds the root alone, pair i > 0
+// the children of parents[i - 1]. A treelet takes up to pairsPerTreelet
+// pairs breadth-first from its root; the interior nodes left on its
+// frontier start the next treelets, depth-first.
+std::vector<BVHBuildNode*> treeletOrder(BVHBuildNode *root, size_t pairsPerTreelet)
+{
+    std::vector<BVHBuildNode*> parents, roots;
+    if (root->left)
+        roots.push_back(root);
+    std::deque<BVHBuildNode*> queue;
+    while (!roots.empty()) {
+        queue.assign(1, roots.back());
+        roots.pop_back();
+        for (size_t n = 0; n < pairsPerTreelet && !queue.empty(); ++n) {
+            BVHBuildNode *p = queue.front();
+            queue.pop_front();
+            parents.push_back(p);
+            for (BVHBuildNode *c : { p->left, p->right })
+                if (c->left)
+                    queue.push_back(c);
+        }
+        roots.insert(roots.end(), queue.rbegin(), queue.rend());
+    }
+    return parents;
+}
+
+int depth(const BVHBuildNode *node)
+{
+    return node->left ? 1 + std::max(depth(node->left), depth(node->right)) : 1;
+}
+
+// 0 and 255 decode to the parent's bounds exactly.
+float dequantize(int q, float lo, float hi)
+{
+    return q == 0 ? lo : q == 255 ? hi : lo + q * ((hi - lo) * (1.0f / 255));
+}
+
+// Conservative 8-bit bounds of child inside parent; returns what they
+// decode to, which is what the child's own children are relative to.
+Bounds3 quantize(const Bounds3 &child, const Bounds3 &parent, QuantizedBVHNode &q)
+{
+    Bounds3 decoded;
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = parent.pMin[axis], hi = parent.pMax[axis], extent = hi - lo;
+        float a = child.pMin[axis], b = child.pMax[axis];
+        int qa = extent > 0 ? (int)std::floor((a - lo) / extent * 255) : 0;
+        int qb = extent > 0 ? (int)std::ceil((b - lo) / extent * 255) : 255;
+        qa = std::min(255, std::max(0, qa));
+        qb = std::min(255, std::max(0, qb));
+        while (qa > 0 && dequantize(qa, lo, hi) > a)
+            --qa;
+        while (qb < 255 && dequantize(qb, lo, hi) < b)
+            ++qb;
+        q.qmin[axis] = qa, q.qmax[axis] = qb;
+        decoded.pMin[axis] = dequantize(qa, lo, hi);
+        decoded.pMax[axis] = dequantize(qb, lo, hi);
+    }
+    return decoded;
+}
+
+Bounds3 dequantize(const QuantizedBVHNode &q, const Bounds3 &parent)
+{
+    Bounds3 b;
+    b.pMin = Vector3f(dequantize(q.qmin[0], parent.pMin.x, parent.pMax.x),
+                      dequantize(q.qmin[1], parent.pMin.y, parent.pMax.y),
+                      dequantize(q.qmin[2], parent.pMin.z, parent.pMax.z));
+    b.pMax = Vector3f(dequantize(q.qmax[0], parent.pMin.x, parent.pMax.x),
+                      dequantize(q.qmax[1], parent.pMin.y, parent.pMax.y),
+                      dequantize(q.qmax[2], parent.pMin.z, parent.pMax.z));
+    return b;
+}
+
+Bounds3 bounds(const LinearBVHNode &n)
+{
+    Bounds3 b;
+    b.pMin = Vector3f(n.bmin[0], n.bmin[1], n.bmin[2]);
+    b.pMax = Vector3f(n.bmax[0], n.bmax[1], n.bmax[2]);
+    return b;
+}
+
+float asFloat(double distance)
+{
+    return distance < FLT_MAX ? (float)distance : std::numeric_limits<float>::infinity();
+}
+
+// flattened traversal keeps at most one entry per level
+constexpr int kMaxFlatDepth = 256;
+// smaller trees fit in a few cache lines either way, and the flat traversal's
+// setup would cost more than it saves (walls and lights are two triangles)
+constexpr size_t kMinFlatPrimitives = 64;
+
+}
+
+void BVHAccel::flatten(NodeLayout newLayout)
+{
+    PROFILE_ZONE("BVH flatten");
+    layout = NodeLayout::Pointer;
+    flatObjects.clear();
+    linearPairs.clear();
+    quantizedPairs.clear();
+    if (newLayout == NodeLayout::Pointer || !root || hasLazyNodes || primitives.size() < kMinFlatPrimitives ||
+        depth(root) > kMaxFlatDepth)
+        return;
+
+    size_t pairBytes = newLayout == NodeLayout::Treelet ? sizeof(LinearBVHPair) : sizeof(QuantizedBVHPair);
+    std::vector<BVHBuildNode*> parents = treeletOrder(root, std::max<size_t>(1, treeletBytes / pairBytes));
+    std::unordered_map<const BVHBuildNode*, uint32_t> pairOf;
+    for (size_t i = 0; i < parents.size(); ++i)
+        pairOf[parents[i]] = i + 1;
+    auto index = [&](const BVHBuildNode *n, auto &out) {
+        out.leaf = !n->left;
+        if (out.leaf) {
+            out.index = flatObjects.size();
+            flatObjects.push_back(n->object);
+        }
+        else
+            out.index = pairOf[n];
+    };
+    rootBounds = root->bounds;
+
+    if (newLayout == NodeLayout::Treelet) {
+        linearPairs.resize(parents.size() + 1);
+        auto fill = [&](LinearBVHNode &out, const BVHBuildNode *n) {
+            for (int axis = 0; axis < 3; ++axis)
+                out.bmin[axis] = n->bounds.pMin[axis], out.bmax[axis] = n->bounds.pMax[axis];
+            index(n, out);
+        };
+        fill(linearPairs[0].node[0], root);
+        for (size_t i = 0; i < parents.size(); ++i) {
+            fill(linearPairs[i + 1].node[0], parents[i]->left);
+            fill(linearPairs[i + 1].node[1], parents[i]->right);
+        }
+    }
+    else {
+        quantizedPairs.resize(parents.size() + 1);
+        index(root, quantizedPairs[0].node[0]);
+        // children are quantized against the bounds their parent decodes to
+        std::vector<std::pair<const BVHBuildNode*, Bounds3>> stack = { { root, rootBounds } };
+        while (!stack.empty()) {
+            auto [n, box] = stack.back();
+            stack.pop_back();
+            if (!n->left)
+                continue;
+            QuantizedBVHPair &pair = quantizedPairs[pairOf[n]];
+            const BVHBuildNode *children[2] = { n->left, n->right };
+            for (int k = 0; k < 2; ++k) {
+                Bounds3 decoded = quantize(children[k]->bounds, box, pair.node[k]);
+                index(children[k], pair.node[k]);
+                stack.push_back({ children[k], decoded });
+            }
+        }
+    }
+    layout = newLayout;
+}
+
+static size_t countNodes(const BVHBuildNode *node)
+{
+    return node ? 1 + countNodes(node->left) + countNodes(node->right) : 0;
+}
+
+size_t BVHAccel::traversalBytes() const
+{
+    if (layout == NodeLayout::Pointer)
+        return countNodes(root) * sizeof(BVHBuildNode);
+    return linearPairs.size() * sizeof(LinearBVHPair) + quantizedPairs.size() * sizeof(QuantizedBVHPair) +
+           flatObjects.size() * sizeof(Object*);
+}
+
 Intersection BVHAccel::Intersect(const Ray& ray) const
 {
     Intersection isect;
     if (!root)
         return isect;
+    if (layout == NodeLayout::Treelet)
+        return intersectTreelets(ray);
+    if (layout == NodeLayout::QuantizedTreelet)
+        return intersectQuantized(ray);
     isect = BVHAccel::getIntersection(root, ray);
     return isect;
 }
 
+Intersection BVHAccel::intersectTreelets(const Ray& ray) const
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    Intersection closest;
+    const LinearBVHNode *stack[kMaxFlatDepth];
+    float entry[kMaxFlatDepth];
+    int top = 0;
+    const LinearBVHNode *node = &linearPairs[0].node[0];
+    RT_STAT(boxTests);
+    if (bounds(*node).Entry(ray, ray.direction_inv, inf) == inf)
+        return closest;
+    for (;;) {
+        RT_STAT(nodeVisits);
+        if (node->leaf) {
+            Intersection hit = flatObjects[node->index]->getIntersection(ray);
+            if (hit.distance < closest.distance)
+                closest = hit;
+        }
+        else {
+            const LinearBVHPair &pair = linearPairs[node->index];
+            float tMax = asFloat(closest.distance);
+            float t0 = bounds(pair.node[0]).Entry(ray, ray.direction_inv, tMax);
+            float t1 = bounds(pair.node[1]).Entry(ray, ray.direction_inv, tMax);
+            RT_STAT(boxTests);
+            RT_STAT(boxTests);
+            if (t0 != inf || t1 != inf) {
+                int nearer = t1 < t0;
+                if (t0 != inf && t1 != inf) {
+                    stack[top] = &pair.node[1 - nearer];
+                    entry[top++] = nearer ? t0 : t1;
+                }
+                node = &pair.node[nearer];
+                continue;
+            }
+        }
+        // skip subtrees that start behind the closest hit found since
+        do {
+            if (top == 0)
+                return closest;
+            --top;
+        } while (entry[top] > closest.distance);
+        node = stack[top];
+    }
+}
+
+Intersection BVHAccel::intersectQuantized(const Ray& ray) const
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    Intersection closest;
+    // plain floats: a Bounds3 array would be initialized on every call
+    struct Entry {
+        const QuantizedBVHNode *node;
+        float t, lo[3], hi[3];
+    };
+    Entry stack[kMaxFlatDepth];
+    int top = 0;
+    const QuantizedBVHNode *node = &quantizedPairs[0].node[0];
+    Bounds3 box = rootBounds;
+    RT_STAT(boxTests);
+    if (box.Entry(ray, ray.direction_inv, inf) == inf)
+        return closest;
+    for (;;) {
+        RT_STAT(nodeVisits);
+        if (node->leaf) {
+            Intersection hit = flatObjects[node->index]->getIntersection(ray);
+            if (hit.distance < closest.distance)
+                closest = hit;
+        }
+        else {
+            const QuantizedBVHPair &pair = quantizedPairs[node->index];
+            Bounds3 b0 = dequantize(pair.node[0], box), b1 = dequantize(pair.node[1], box);
+            float tMax = asFloat(closest.distance);
+            float t0 = b0.Entry(ray, ray.direction_inv, tMax);
+            float t1 = b1.Entry(ray, ray.direction_inv, tMax);
+            RT_STAT(boxTests);
+            RT_STAT(boxTests);
+            if (t0 != inf || t1 != inf) {
+                int nearer = t1 < t0;
+                if (t0 != inf && t1 != inf) {
+                    const Bounds3 &far = nearer ? b0 : b1;
+                    stack[top++] = { &pair.node[1 - nearer], nearer ? t0 : t1,
+                                     { far.pMin.x, far.pMin.y, far.pMin.z }, { far.pMax.x, far.pMax.y, far.pMax.z } };
+                }
+                node = &pair.node[nearer];
+                box = nearer ? b1 : b0;
+                continue;
+            }
+        }
+        do {
+            if (top == 0)
+                return closest;
+            --top;
+        } while (stack[top].t > closest.distance);
+        node = stack[top].node;
+        box.pMin = Vector3f(stack[top].lo[0], stack[top].lo[1], stack[top].lo[2]);
+        box.pMax = Vector3f(stack[top].hi[0], stack[top].hi[1], stack[top].hi[2]);
+    }
+}
+
 Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
 {
     // TODO Traverse the BVH to find intersection
@@ -113,8 +793,12 @@ Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
 	dirIsNeg[0] = int(ray.direction.x >= 0);
 	dirIsNeg[1] = int(ray.direction.y >= 0);
 	dirIsNeg[2] = int(ray.direction.z >= 0);
+    RT_STAT(boxTests);
     if(!node->bounds.IntersectP(ray, ray.direction_inv, dirIsNeg))
         return intersect;
+    RT_STAT(nodeVisits);
+    if(!node->ready())
+        expand(node);
     if(node->left == nullptr && node->right == nullptr){
         intersect = node->object->getIntersection(ray);
         return intersect;
@@ -125,18 +809,24 @@ Intersection BVHAccel::getIntersection(BVHBuildNode* node, const Ray& ray) const
 }
 
 
-void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf){
+void BVHAccel::getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf, float v){
+    if(!node->ready())
+        expand(node);
     if(node->left == nullptr || node->right == nullptr){
-        node->object->Sample(pos, pdf);
-        pdf *= node->area;
+        // the position of p inside this leaf is uniform again; reuse it
+        float u = std::min(OneMinusEpsilon, std::max(0.0f, p / node->area));
+        node->object->Sample(pos, pdf, Vector2f(u, v));
+        // duplicated objects are reached through all their leaves
+        pdf *= node->object->getArea();
         return;
     }
-    if(p < node->left->area) getSample(node->left, p, pos, pdf);
-    else getSample(node->right, p - node->left->area, pos, pdf);
+    if(p < node->left->area) getSample(node->left, p, pos, pdf, v);
+    else getSample(node->right, p - node->left->area, pos, pdf, v);
 }
 
-void BVHAccel::Sample(Intersection &pos, float &pdf){
-    float p = std::sqrt(get_random_float()) * root->area;
-    getSample(root, p, pos, pdf);
+void BVHAccel::Sample(Intersection &pos, float &pdf, const Vector2f &u){
+    // picks a primitive proportionally to its area
+    float p = u.x * root->area;
+    getSample(root, p, pos, pdf, u.y);
     pdf /= root->area;
 }
\ No newline at end of file
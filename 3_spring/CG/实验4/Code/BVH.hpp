@@ -6,6 +6,7 @@
 #define RAYTRACING_BVH_H
 
 #include <atomic>
+#include <mutex>
 #include <vector>
 #include <memory>
 #include <ctime>
@@ -19,13 +20,61 @@ struct BVHBuildNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 
+// Flattened node. Siblings are stored as a pair, so a traversal step reads
+// both children's bounds from one place; `index` is the children's pair
+// (interior) or the object (leaf).
+struct LinearBVHNode {
+    float bmin[3], bmax[3];
+    uint32_t index, leaf;
+};
+struct alignas(64) LinearBVHPair {
+    LinearBVHNode node[2];
+};
+
+// 8-bit bounds relative to the parent's decoded bounds, 12 bytes.
+struct QuantizedBVHNode {
+    uint8_t qmin[3], qmax[3];
+    uint8_t leaf, pad;
+    uint32_t index;
+};
+struct QuantizedBVHPair {
+    QuantizedBVHNode node[2];
+};
+
 // BVHAccel Declarations
 inline int leafNodes, totalLeafNodes, totalPrimitives, interiorNodes;
 class BVHAccel {
 
 public:
     // BVHAccel Public Types
-    enum class SplitMethod { NAIVE, SAH };
+    // SBVH: binned SAH object splits plus spatial splits, which cut large
+    // overlapping primitives at a plane and reference them from both sides
+    // (Stich et al. 2009). Leaves then hold clipped bounds.
+    enum class SplitMethod { NAIVE, SAH, SBVH };
+
+    // What meshes and scenes build with.
+    inline static SplitMethod defaultSplitMethod = SplitMethod::NAIVE;
+
+    // Node layout traversed by Intersect(). Pointer walks the build nodes;
+    // Treelet copies the tree into sibling pairs of 32-byte nodes, grouped
+    // breadth-first into treelets of treeletBytes so a ray's first steps
+    // stay within a few cache lines or pages; QuantizedTreelet does the same
+    // with 12-byte nodes. Flattened traversal is iterative, nearer child
+    // first, and skips boxes behind the closest hit. The build nodes stay
+    // for light sampling and refit. Not used for lazy or tiny BVHs.
+    enum class NodeLayout { Pointer, Treelet, QuantizedTreelet };
+    inline static NodeLayout defaultLayout = NodeLayout::Pointer;
+    inline static int treeletBytes = 4096;
+    // Memory cap for SBVH: extra references allowed, as a fraction of the
+    // primitive count.
+    inline static float spatialSplitBudget = 0.3f;
+
+    // Lazy build: nodes over more than this many primitives are only split
+    // when a ray (or light sample) first reaches them, so rendering starts
+    // before the whole hierarchy exists and unseen geometry is never split.
+    // The finished parts are the same tree an eager build makes. 0 builds
+    // everything up front; applies to BVHs constructed afterwards.
+    inline static int lazyBuildThreshold = 0;
 
     // BVHAccel Public Methods
     BVHAccel(std::vector<Object*> p, int maxPrimsInNode = 1, SplitMethod splitMethod = SplitMethod::NAIVE);
@@ -35,18 +84,55 @@ public:
     Intersection Intersect(const Ray &ray) const;
     Intersection getIntersection(BVHBuildNode* node, const Ray& ray)const;
     bool IntersectP(const Ray &ray) const;
-    BVHBuildNode* root;
+    BVHBuildNode* root = nullptr;
+
+    // Animation: recomputes bounds and areas bottom-up after primitives
+    // moved, keeping the tree shape. Once the refit tree's SAH cost grows
+    // past rebuildRatio times its cost after the last build it is rebuilt
+    // instead (0 never rebuilds). Returns true if it rebuilt.
+    bool refit(float rebuildRatio = 2.0f);
+    // Sum of node surface areas relative to the root's; lower traverses faster.
+    float sahCost() const;
+    float builtCost = 0;
+
+    // (Re)creates the flattened copy for layout from the build nodes.
+    void flatten(NodeLayout layout);
+    // Size of what Intersect() walks: the flat copy, or the build nodes.
+    size_t traversalBytes() const;
 
     // BVHAccel Private Methods
-    BVHBuildNode* recursiveBuild(std::vector<Object*>objects);
+    // the whole tree with splitMethod (lazy builds and SBVH don't mix)
+    BVHBuildNode* buildTree();
+    Intersection intersectTreelets(const Ray &ray) const;
+    Intersection intersectQuantized(const Ray &ray) const;
+    BVHBuildNode* recursiveBuild(std::vector<Object*>objects) const;
+    // recursiveBuild, or a lazy node if objects is over lazyBuildThreshold
+    BVHBuildNode* buildNode(std::vector<Object*> objects) const;
+    // Builds the children of a lazy node; safe to call from any thread.
+    void expand(BVHBuildNode* node) const;
+    bool hasLazyNodes = false;
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<Object*> primitives;
 
-    void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf);
-    void Sample(Intersection &pos, float &pdf);
+    NodeLayout layout = NodeLayout::Pointer;
+    Bounds3 rootBounds;
+    std::vector<Object*> flatObjects;
+    std::vector<LinearBVHPair> linearPairs;
+    std::vector<QuantizedBVHPair> quantizedPairs;
+
+    void getSample(BVHBuildNode* node, float p, Intersection &pos, float &pdf, float v);
+    void Sample(Intersection &pos, float &pdf, const Vector2f &u);
+};
+
+// The primitives below a lazy node that has not been split yet. `built` is
+// set (with release order) once the node's children are in place.
+struct BVHLazyRange {
+    std::vector<Object*> objects;
+    std::once_flag once;
+    std::atomic<bool> built{false};
 };
 
 struct BVHBuildNode {
@@ -58,12 +144,20 @@ struct BVHBuildNode {
 
 public:
     int splitAxis=0, firstPrimOffset=0, nPrimitives=0;
+    BVHLazyRange *lazy = nullptr;
+    // leaves: how many leaves reference the object (SBVH duplicates); each
+    // holds that share of its area so sampling stays uniform
+    int references = 1;
     // BVHBuildNode Public Methods
     BVHBuildNode(){
         bounds = Bounds3();
         left = nullptr;right = nullptr;
         object = nullptr;
     }
+    ~BVHBuildNode() { delete lazy; }
+
+    // False for a lazy node whose children are not built yet.
+    bool ready() const { return !lazy || lazy->built.load(std::memory_order_acquire); }
 };
 
 
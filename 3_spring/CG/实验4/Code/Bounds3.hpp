@@ -85,6 +85,12 @@ class Bounds3
     }
 
     inline bool IntersectP(const Ray& ray, const Vector3f& invDir, const std::array<int, 3>& dirIsNeg) const;
+    // Distance at which the ray enters the box (0 if it starts inside), or
+    // infinity if it misses the box or enters it beyond tMax.
+    inline float Entry(const Ray& ray, const Vector3f& invDir, float tMax) const;
+
+  private:
+    inline void Slabs(const Ray& ray, const Vector3f& invDir, float& ten, float& tex) const;
 };
 
 
@@ -95,19 +101,49 @@ inline bool Bounds3::IntersectP(const Ray& ray, const Vector3f& invDir,
     // invDir: ray direction(x,y,z), invDir=(1.0/x,1.0/y,1.0/z), use this because Multiply is faster that Division
     // dirIsNeg: ray direction(x,y,z), dirIsNeg=[int(x>0),int(y>0),int(z>0)], use this to simplify your logic
     // TODO test if ray bound intersects
+    float ten, tex;
+    Slabs(ray, invDir, ten, tex);
+    return ten <= tex && tex >= 0;
+}
+
+inline float Bounds3::Entry(const Ray& ray, const Vector3f& invDir, float tMax) const
+{
+    float ten, tex;
+    Slabs(ray, invDir, ten, tex);
+    return ten <= tex && tex >= 0 && ten <= tMax ? std::max(ten, 0.0f) : std::numeric_limits<float>::infinity();
+}
+
+// Entry and exit distances of the ray's line through the three slabs.
+inline void Bounds3::Slabs(const Ray& ray, const Vector3f& invDir, float& ten, float& tex) const
+{
+#if RAYTRACING_SIMD_SSE
+    // All three slabs at once; min/max pick the entry and exit planes so
+    // dirIsNeg is not needed here. The padding lane is forced to (-inf, inf).
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(pMin.simd(), ray.origin.simd()), invDir.simd());
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(pMax.simd(), ray.origin.simd()), invDir.simd());
+    const __m128 inf = _mm_set_ps(std::numeric_limits<float>::infinity(), 0, 0, 0);
+    const __m128 lane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+    __m128 tn = _mm_or_ps(_mm_andnot_ps(lane, _mm_min_ps(t0, t1)), _mm_sub_ps(_mm_setzero_ps(), inf));
+    __m128 tx = _mm_or_ps(_mm_andnot_ps(lane, _mm_max_ps(t0, t1)), inf);
+    tn = _mm_max_ps(tn, _mm_shuffle_ps(tn, tn, _MM_SHUFFLE(2, 3, 0, 1)));
+    tn = _mm_max_ps(tn, _mm_shuffle_ps(tn, tn, _MM_SHUFFLE(1, 0, 3, 2)));
+    tx = _mm_min_ps(tx, _mm_shuffle_ps(tx, tx, _MM_SHUFFLE(2, 3, 0, 1)));
+    tx = _mm_min_ps(tx, _mm_shuffle_ps(tx, tx, _MM_SHUFFLE(1, 0, 3, 2)));
+    ten = _mm_cvtss_f32(tn), tex = _mm_cvtss_f32(tx);
+#else
     const auto& origin = ray.origin;
-	float ten = -std::numeric_limits<float>::infinity();
-	float tex = std::numeric_limits<float>::infinity();
+	ten = -std::numeric_limits<float>::infinity();
+	tex = std::numeric_limits<float>::infinity();
 	for (int i = 0; i < 3; i++)
 	{
 		float min = (pMin[i] - origin[i]) * invDir[i];
 		float max = (pMax[i] - origin[i]) * invDir[i];
-		if (!dirIsNeg[i])
+		if (min > max)
 			std::swap(min, max);
 		ten = std::max(min, ten);
 		tex = std::min(max, tex);
     }
-    return ten <= tex && tex >= 0;
+#endif
 }
 
 inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
@@ -0,0 +1,76 @@
+//
+// Pinhole camera matching the original primary-ray setup: eye at eye_pos,
+// looking down +z, with the image x axis mirrored (dir = (-x, y, 1)).
+//
+
+#ifndef RAYTRACING_CAMERA_H
+#define RAYTRACING_CAMERA_H
+
+#include "Vector.hpp"
+#include "Ray.hpp"
+#include "global.hpp"
+
+class Camera
+{
+public:
+    Camera(const Vector3f &eye, float fovDeg, int w, int h)
+        : eye(eye), width(w), height(h)
+    {
+        scale = std::tan(fovDeg * 0.5f * M_PI / 180.0f);
+        aspect = w / (float)h;
+        // area of the image rectangle on the z = 1 plane
+        imageArea = (2 * aspect * scale) * (2 * scale);
+    }
+
+    // Primary ray through raster position (x, y), e.g. (i + jitter.x, j + jitter.y).
+    Ray generateRay(float x, float y) const
+    {
+        float px = (2 * x / (float)width - 1) * aspect * scale;
+        float py = (1 - 2 * y / (float)height) * scale;
+        return Ray(eye, normalize(Vector3f(-px, py, 1)));
+    }
+
+    // Raster position of world point p; false if it is behind the camera or
+    // outside the image.
+    bool rasterPosition(const Vector3f &p, Vector2f &raster) const
+    {
+        Vector3f d = p - eye;
+        if (d.z <= 0)
+            return false;
+        float px = -d.x / d.z, py = d.y / d.z;
+        raster.x = (px / (aspect * scale) + 1) * 0.5f * width;
+        raster.y = (1 - py / scale) * 0.5f * height;
+        return raster.x >= 0 && raster.x < width && raster.y >= 0 && raster.y < height;
+    }
+
+    // Importance We and solid-angle pdf of a unit direction leaving the eye.
+    float importance(const Vector3f &dir) const
+    {
+        float cosTheta = dir.z;
+        if (cosTheta <= 0 || !insideImage(dir))
+            return 0;
+        float cos2 = cosTheta * cosTheta;
+        return 1.0f / (imageArea * cos2 * cos2);
+    }
+
+    float pdfDirection(const Vector3f &dir) const
+    {
+        float cosTheta = dir.z;
+        if (cosTheta <= 0 || !insideImage(dir))
+            return 0;
+        return 1.0f / (imageArea * cosTheta * cosTheta * cosTheta);
+    }
+
+    Vector3f eye;
+    int width, height;
+    float scale, aspect, imageArea;
+
+private:
+    bool insideImage(const Vector3f &dir) const
+    {
+        float px = -dir.x / dir.z, py = dir.y / dir.z;
+        return std::fabs(px) <= aspect * scale && std::fabs(py) <= scale;
+    }
+};
+
+#endif //RAYTRACING_CAMERA_H
@@ -0,0 +1,109 @@
+//
+// A-trous wavelet denoiser.
+//
+
+#include <cmath>
+#include "Denoiser.hpp"
+#include "Profiler.hpp"
+
+namespace {
+
+// B3 spline, the 1D taps of the 5x5 kernel
+const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+inline float luminance(const Vector3f &v) { return 0.2126f * v.x + 0.7152f * v.y + 0.0722f * v.z; }
+
+}
+
+void Denoiser::denoise(std::vector<Vector3f> &color, const AOVs &aovs, int width, int height) const
+{
+    PROFILE_ZONE("denoise");
+    const int n = width * height;
+    // filter the untextured illumination so albedo edges stay sharp
+    std::vector<Vector3f> a(n), b(n);
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        const Vector3f &alb = aovs.albedo[i];
+        a[i] = Vector3f(alb.x > 0 ? color[i].x / alb.x : color[i].x,
+                        alb.y > 0 ? color[i].y / alb.y : color[i].y,
+                        alb.z > 0 ? color[i].z / alb.z : color[i].z);
+    }
+
+    // noise estimate: luminance variance over the 3x3 neighbourhood
+    std::vector<float> va(n), vb(n);
+    #pragma omp parallel for
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float m1 = 0, m2 = 0;
+            int count = 0;
+            for (int j = std::max(0, y - 1); j <= std::min(height - 1, y + 1); ++j)
+                for (int i = std::max(0, x - 1); i <= std::min(width - 1, x + 1); ++i) {
+                    float l = luminance(a[j * width + i]);
+                    m1 += l;
+                    m2 += l * l;
+                    ++count;
+                }
+            m1 /= count;
+            va[y * width + x] = std::max(0.0f, m2 / count - m1 * m1);
+        }
+    }
+
+    for (int it = 0; it < iterations; ++it) {
+        pass(a, va, b, vb, aovs, width, height, 1 << it);
+        a.swap(b);
+        va.swap(vb);
+    }
+
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        const Vector3f &alb = aovs.albedo[i];
+        color[i] = Vector3f(alb.x > 0 ? a[i].x * alb.x : a[i].x,
+                            alb.y > 0 ? a[i].y * alb.y : a[i].y,
+                            alb.z > 0 ? a[i].z * alb.z : a[i].z);
+    }
+}
+
+void Denoiser::pass(const std::vector<Vector3f> &in, const std::vector<float> &varIn,
+                    std::vector<Vector3f> &out, std::vector<float> &varOut,
+                    const AOVs &aovs, int width, int height, int step) const
+{
+    const float invN = 1.0f / (sigmaNormal * sigmaNormal);
+    const float invD = 1.0f / (sigmaDepth * sigmaDepth);
+    const float invA = 1.0f / (sigmaAlbedo * sigmaAlbedo);
+
+    #pragma omp parallel for schedule(dynamic, 8)
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int p = y * width + x;
+            const Vector3f cp = in[p], np = aovs.normal[p], ap = aovs.albedo[p];
+            const float dp = aovs.depth[p];
+            const float lp = luminance(cp);
+            const float invL = 1.0f / (sigmaLuminance * std::sqrt(varIn[p]) + 1e-4f);
+            Vector3f sum;
+            float wSum = 0.0f, varSum = 0.0f;
+            for (int j = -2; j <= 2; ++j) {
+                int qy = y + j * step;
+                if (qy < 0 || qy >= height)
+                    continue;
+                for (int i = -2; i <= 2; ++i) {
+                    int qx = x + i * step;
+                    if (qx < 0 || qx >= width)
+                        continue;
+                    const int q = qy * width + qx;
+                    // Vector3f arithmetic is packed SSE; only the exp is scalar
+                    Vector3f dn = aovs.normal[q] - np, da = aovs.albedo[q] - ap;
+                    float dd = dp > 0 ? (aovs.depth[q] - dp) / dp : 0.0f;
+                    float e = std::fabs(luminance(in[q]) - lp) * invL + dotProduct(dn, dn) * invN
+                            + dd * dd * invD + dotProduct(da, da) * invA;
+                    float w = kernel[i + 2] * kernel[j + 2] * std::exp(-e);
+                    sum += in[q] * w;
+                    varSum += w * w * varIn[q];
+                    wSum += w;
+                }
+            }
+            // the centre tap always has weight kernel[2]^2 > 0
+            out[p] = sum / wSum;
+            varOut[p] = varSum / (wSum * wSum);
+        }
+    }
+}
@@ -0,0 +1,40 @@
+//
+// Edge-avoiding A-trous wavelet denoiser (Dammertz et al. 2010), guided by
+// first-hit albedo, normal and depth buffers. Colour edges are judged
+// against a per-pixel noise estimate that is filtered along with the image,
+// as in SVGF (Schied et al. 2017), so no absolute colour threshold is needed.
+//
+
+#ifndef RAYTRACING_DENOISER_H
+#define RAYTRACING_DENOISER_H
+
+#include <vector>
+#include "Vector.hpp"
+
+// Auxiliary buffers of the first non-mirror hit, averaged over a few
+// jittered rays per pixel. Mirror reflectance is folded into the albedo.
+struct AOVs
+{
+    std::vector<Vector3f> albedo, normal;
+    std::vector<float> depth;
+};
+
+class Denoiser
+{
+public:
+    // color is replaced by the filtered image.
+    void denoise(std::vector<Vector3f> &color, const AOVs &aovs, int width, int height) const;
+
+    int iterations = 5;        // filter footprint 2^iterations * 4 + 1 pixels
+    float sigmaLuminance = 4.0f; // in standard deviations of the noise
+    float sigmaNormal = 0.3f;
+    float sigmaDepth = 0.05f;  // relative to the pixel's depth
+    float sigmaAlbedo = 0.1f;
+
+private:
+    void pass(const std::vector<Vector3f> &in, const std::vector<float> &varIn,
+              std::vector<Vector3f> &out, std::vector<float> &varOut,
+              const AOVs &aovs, int width, int height, int step) const;
+};
+
+#endif //RAYTRACING_DENOISER_H
@@ -0,0 +1,269 @@
+//
+// Coordinator and worker sides of distributed tile rendering.
+//
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Distributed.hpp"
+#include "RenderService.hpp"
+#include "Socket.hpp"
+#include "ImageIO.hpp"
+#include "Profiler.hpp"
+
+namespace {
+
+struct Tile {
+    int x0, y0, x1, y1;
+};
+
+std::string tileText(const char *word, const Tile &t)
+{
+    std::ostringstream out;
+    out << word << " " << t.x0 << " " << t.y0 << " " << t.x1 << " " << t.y1;
+    return out.str();
+}
+
+// Shared by the coordinator and its connection threads, which may outlive
+// coordinateRender() by a few instructions.
+struct Coordinator {
+    std::string sceneLine;
+    int width = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Tile> pending;
+    int total = 0, finished = 0, connected = 0;
+    std::vector<Vector3f> image;
+};
+
+// Hands out tiles to one worker connection until none are left. A tile
+// whose result does not come back is queued again for the other workers.
+void serveWorker(std::shared_ptr<Coordinator> c, int fd)
+{
+    Connection conn(fd);
+    if (!conn.writeLine(c->sceneLine))
+        return;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        ++c->connected;
+    }
+    std::vector<float> pixels;
+    std::string reply;
+    for (;;) {
+        Tile tile;
+        {
+            std::unique_lock<std::mutex> lock(c->mutex);
+            c->cv.wait(lock, [&] { return !c->pending.empty() || c->finished == c->total; });
+            if (c->pending.empty())
+                break;
+            tile = c->pending.front();
+            c->pending.pop_front();
+        }
+
+        pixels.resize((tile.x1 - tile.x0) * (tile.y1 - tile.y0) * 3);
+        bool ok = conn.writeLine(tileText("tile", tile)) && conn.readLine(reply) &&
+                  reply == tileText("pixels", tile) && conn.readExact(pixels.data(), pixels.size() * sizeof(float));
+
+        std::lock_guard<std::mutex> lock(c->mutex);
+        if (!ok) {
+            c->pending.push_front(tile);
+            --c->connected;
+            c->cv.notify_all();
+            std::cerr << "worker lost" << (reply.rfind("error", 0) == 0 ? " (" + reply + ")" : "")
+                      << ", reassigning tile " << tile.x0 << "," << tile.y0 << "\n";
+            return;
+        }
+        const float *p = pixels.data();
+        for (int j = tile.y0; j < tile.y1; ++j)
+            for (int i = tile.x0; i < tile.x1; ++i, p += 3)
+                c->image[j * c->width + i] = Vector3f(p[0], p[1], p[2]);
+        ++c->finished;
+        c->cv.notify_all();
+    }
+    conn.writeLine("done");
+    std::lock_guard<std::mutex> lock(c->mutex);
+    --c->connected;
+}
+
+void startLocalWorker(int port, std::vector<pid_t> &children)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::string address = "127.0.0.1:" + std::to_string(port);
+        execl("/proc/self/exe", "RayTracing", "--worker", address.c_str(), "--threads", "1", (char*)nullptr);
+        perror("exec worker");
+        _exit(127);
+    }
+    if (pid > 0)
+        children.push_back(pid);
+    else
+        perror("fork");
+}
+
+}
+
+int coordinateRender(const std::string &scenePath, const std::vector<std::string> &extra, const std::string &output,
+                     int port, int localWorkers, int tileSize)
+{
+    char absolute[PATH_MAX];
+    if (!realpath(scenePath.c_str(), absolute)) {
+        perror(scenePath.c_str());
+        return 1;
+    }
+    // loaded here only to check it and to learn the resolution
+    SceneLoader loader;
+    Renderer settings;
+    std::unique_ptr<Scene> scene = loader.load(absolute, extra, settings);
+    if (!scene)
+        return 1;
+
+    auto c = std::make_shared<Coordinator>();
+    c->sceneLine = std::string("scene ") + absolute;
+    for (const std::string &s : extra)
+        c->sceneLine += " ; " + s;
+    c->width = scene->width;
+    c->image.resize(scene->width * scene->height);
+    if (tileSize <= 0)
+        tileSize = 32;
+    for (int y = 0; y < scene->height; y += tileSize)
+        for (int x = 0; x < scene->width; x += tileSize)
+            c->pending.push_back({ x, y, std::min(x + tileSize, scene->width), std::min(y + tileSize, scene->height) });
+    c->total = (int)c->pending.size();
+
+    int listenFd = listenTcp(port);
+    if (listenFd < 0)
+        return 1;
+    port = boundPort(listenFd);
+    std::cout << "coordinating " << c->total << " tiles at " << settings.spp << " spp on port " << port << "\n";
+
+    std::vector<pid_t> children;
+    for (int i = 0; i < localWorkers; ++i)
+        startLocalWorker(port, children);
+    std::thread acceptor([c, listenFd] {
+        for (int fd; (fd = acceptTcp(listenFd)) >= 0;)
+            std::thread(serveWorker, c, fd).detach();
+    });
+
+    {
+        PROFILE_ZONE("render");
+        std::unique_lock<std::mutex> lock(c->mutex);
+        while (!c->cv.wait_for(lock, std::chrono::seconds(1), [&] { return c->finished == c->total; }))
+            std::cout << "tiles " << c->finished << "/" << c->total << ", " << c->connected << " workers\n";
+    }
+    // wakes the accept thread; it must be gone before the fd number can be
+    // reused by the image writes below
+    shutdown(listenFd, SHUT_RDWR);
+    acceptor.join();
+    close(listenFd);
+
+    std::vector<Vector3f> image;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        image = c->image;
+    }
+    bool written = writePPM((output + ".ppm").c_str(), image, scene->width, scene->height, 0.6f) &&
+                   writePFM((output + ".pfm").c_str(), image, scene->width, scene->height) &&
+                   writeEXR((output + ".exr").c_str(), image, scene->width, scene->height);
+    for (pid_t pid : children)
+        waitpid(pid, nullptr, 0);
+    return written ? 0 : 1;
+}
+
+namespace {
+
+// Everything a worker needs to render tiles of the coordinator's scene.
+struct WorkerScene {
+    std::string line;
+    std::unique_ptr<Scene> scene;
+    std::unique_ptr<Camera> camera;
+    std::unique_ptr<Sampler> sampler;
+    std::unique_ptr<PathIntegrator> integrator;
+    int spp = 0;
+};
+
+bool loadWorkerScene(const std::string &line, SceneLoader &loader, WorkerScene &ws)
+{
+    std::vector<std::string> parts;
+    std::istringstream in(line);
+    for (std::string part; std::getline(in, part, ';');)
+        parts.push_back(part);
+    std::istringstream head(parts.empty() ? "" : parts[0]);
+    std::string word, path;
+    if (!(head >> word >> path) || word != "scene")
+        return false;
+    Renderer settings;
+    ws.scene = loader.load(path, std::vector<std::string>(parts.begin() + 1, parts.end()), settings);
+    if (!ws.scene)
+        return false;
+    ws.line = line;
+    ws.spp = settings.spp;
+    ws.camera = std::make_unique<Camera>(settings.eye, ws.scene->fov, ws.scene->width, ws.scene->height);
+    ws.sampler = makeSampler(settings.samplerType, settings.spp);
+    ws.integrator = std::make_unique<PathIntegrator>(*ws.scene);
+    return true;
+}
+
+void renderTiles(Connection &conn, const WorkerScene &ws)
+{
+    std::string line;
+    std::vector<float> pixels;
+    while (conn.readLine(line)) {
+        std::istringstream in(line);
+        std::string word;
+        Tile t;
+        if (!(in >> word >> t.x0 >> t.y0 >> t.x1 >> t.y1) || word != "tile" || t.x0 < 0 || t.y0 < 0 ||
+            t.x1 > ws.scene->width || t.y1 > ws.scene->height || t.x0 >= t.x1 || t.y0 >= t.y1)
+            return;
+        {
+            PROFILE_ZONE("worker tile", t.y0);
+            renderTile(*ws.camera, *ws.integrator, *ws.sampler, ws.spp, t.x0, t.y0, t.x1, t.y1, pixels);
+        }
+        if (!conn.writeLine(tileText("pixels", t)) || !conn.writeAll(pixels.data(), pixels.size() * sizeof(float)))
+            return;
+    }
+}
+
+}
+
+int runRenderWorker(const std::string &address, int threads)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << address << ": expected host:port\n";
+        return 1;
+    }
+    std::string host = address.substr(0, colon);
+    int port = std::atoi(address.c_str() + colon + 1);
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // the first connection tells us the scene; the others must agree
+    auto first = std::make_unique<Connection>(connectTcp(host, port));
+    std::string line;
+    if (!first->valid() || !first->readLine(line))
+        return 1;
+    SceneLoader loader;
+    WorkerScene ws;
+    if (!loadWorkerScene(line, loader, ws)) {
+        first->writeLine("error worker cannot load " + line);
+        return 1;
+    }
+
+    std::vector<std::thread> pool;
+    pool.emplace_back([&ws, conn = std::move(first)] { renderTiles(*conn, ws); });
+    for (int i = 1; i < threads; ++i)
+        pool.emplace_back([&ws, host, port] {
+            Connection conn(connectTcp(host, port));
+            std::string scene;
+            if (conn.valid() && conn.readLine(scene) && scene == ws.line)
+                renderTiles(conn, ws);
+        });
+    for (std::thread &t : pool)
+        t.join();
+    return 0;
+}
@@ -0,0 +1,38 @@
+//
+// Distributed tile rendering over TCP. A coordinator splits the image into
+// tiles and hands them to worker processes, local or on other hosts, that
+// connect to it:
+//
+//   RayTracing --coordinate 7000 --workers 2 --output frame file.scene
+//   RayTracing --worker coordinator-host:7000        (on any other machine)
+//
+// Each tile is rendered with the samples fixed by its pixel coordinates, so
+// the image does not depend on which worker rendered what and matches a
+// local render. Tiles of a worker that disconnects go back into the queue.
+// Workers load the scene file by the coordinator's absolute path, so every
+// host needs the scene and models at the same place.
+//
+// Protocol, coordinator to worker:
+//   scene <absolute path> [; statement]...     once per connection
+//   tile <x0> <y0> <x1> <y1>                   until "done"
+// worker to coordinator, per tile:
+//   pixels <x0> <y0> <x1> <y1>                 then (x1-x0)*(y1-y0)*3 floats
+//
+
+#ifndef RAYTRACING_DISTRIBUTED_H
+#define RAYTRACING_DISTRIBUTED_H
+
+#include <string>
+#include <vector>
+
+// Renders scenePath (with extra statements such as "spp 64") on whatever
+// workers connect to port, after starting localWorkers worker processes on
+// this machine. Writes <output>.ppm/.pfm/.exr; returns an exit code.
+int coordinateRender(const std::string &scenePath, const std::vector<std::string> &extra, const std::string &output,
+                     int port, int localWorkers, int tileSize);
+
+// Serves tiles for the coordinator at "host:port" on `threads` connections
+// (0: one per hardware thread) until it has no more work.
+int runRenderWorker(const std::string &address, int threads);
+
+#endif //RAYTRACING_DISTRIBUTED_H
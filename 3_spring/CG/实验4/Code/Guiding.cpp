@@ -0,0 +1,372 @@
+//
+// Practical path guiding with an SD-tree.
+//
+
+#include <omp.h>
+#include "Guiding.hpp"
+
+namespace {
+
+const int maxDTreeDepth = 20;
+const int maxSTreeDepth = 24;
+
+inline float average(const Vector3f &v) { return (v.x + v.y + v.z) / 3.0f; }
+
+// Component-wise c / t, zero where t has no energy.
+inline Vector3f divide(const Vector3f &c, const Vector3f &t)
+{
+    return Vector3f(t.x > 0 ? c.x / t.x : 0, t.y > 0 ? c.y / t.y : 0, t.z > 0 ? c.z / t.z : 0);
+}
+
+}
+
+DTree::DTree() : nodes(1) {}
+
+Vector2f DTree::toSquare(const Vector3f &dir)
+{
+    float cosTheta = clamp(-1, 1, dir.z);
+    float phi = std::atan2(dir.y, dir.x);
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Vector2f(std::min(OneMinusEpsilon, (cosTheta + 1) * 0.5f),
+                    std::min(OneMinusEpsilon, phi / (2 * M_PI)));
+}
+
+Vector3f DTree::toSphere(const Vector2f &p)
+{
+    float cosTheta = 2 * p.x - 1;
+    float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+    float phi = 2 * M_PI * p.y;
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+void DTree::record(const Vector3f &dir, float value)
+{
+    if (!(value >= 0) || std::isinf(value))
+        return;
+    #pragma omp atomic
+    sampleCount++;
+    if (value == 0)
+        return;
+    Vector2f p = toSquare(dir);
+    uint32_t idx = 0;
+    while (true) {
+        int qx = p.x >= 0.5f, qy = p.y >= 0.5f;
+        int q = qx + 2 * qy;
+        #pragma omp atomic
+        nodes[idx].sum[q] += value;
+        if (nodes[idx].child[q] == 0)
+            return;
+        idx = nodes[idx].child[q];
+        p = Vector2f(p.x * 2 - qx, p.y * 2 - qy);
+    }
+}
+
+Vector3f DTree::sample(const Vector2f &u) const
+{
+    if (total() <= 0)
+        return toSphere(u);
+    Vector2f r = u, origin(0.0f);
+    float size = 1.0f;
+    uint32_t idx = 0;
+    while (true) {
+        const Node &node = nodes[idx];
+        float t = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        if (t <= 0)
+            break; // nothing recorded below here: uniform over the cell
+        // pick the column, then the row inside it, reusing the random numbers
+        float left = (node.sum[0] + node.sum[2]) / t;
+        int qx;
+        if (r.x < left) {
+            qx = 0;
+            r.x = r.x / left;
+        } else {
+            qx = 1;
+            r.x = (r.x - left) / (1 - left);
+        }
+        float colSum = node.sum[qx] + node.sum[qx + 2];
+        float bottom = colSum > 0 ? node.sum[qx] / colSum : 0.5f;
+        int qy;
+        if (r.y < bottom) {
+            qy = 0;
+            r.y = r.y / bottom;
+        } else {
+            qy = 1;
+            r.y = (r.y - bottom) / (1 - bottom);
+        }
+        r = Vector2f(std::min(OneMinusEpsilon, r.x), std::min(OneMinusEpsilon, r.y));
+        size *= 0.5f;
+        origin = origin + Vector2f(qx * size, qy * size);
+        int q = qx + 2 * qy;
+        if (node.child[q] == 0)
+            break;
+        idx = node.child[q];
+    }
+    return toSphere(origin + r * size);
+}
+
+float DTree::pdf(const Vector3f &dir) const
+{
+    if (total() <= 0)
+        return 1.0f / (4 * M_PI);
+    Vector2f p = toSquare(dir);
+    float density = 1.0f;
+    uint32_t idx = 0;
+    while (true) {
+        const Node &node = nodes[idx];
+        float t = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        if (t <= 0)
+            break;
+        int qx = p.x >= 0.5f, qy = p.y >= 0.5f;
+        int q = qx + 2 * qy;
+        density *= 4 * node.sum[q] / t;
+        if (node.child[q] == 0 || density == 0)
+            break;
+        idx = node.child[q];
+        p = Vector2f(p.x * 2 - qx, p.y * 2 - qy);
+    }
+    // the cylindrical map preserves area: dOmega = 4 pi du dv
+    return density / (4 * M_PI);
+}
+
+void DTree::refineFrom(const DTree &from, float threshold)
+{
+    nodes.assign(1, Node());
+    sampleCount = 0;
+    const float t = from.total();
+    if (t <= 0)
+        return;
+
+    // src < 0 means a cell `from` never subdivided; its energy is spread
+    // evenly over the four quadrants.
+    struct Item { uint32_t dst; int src; float energy; int depth; };
+    std::vector<Item> stack{{0, 0, t, 1}};
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+        for (int q = 0; q < 4; ++q) {
+            float e = item.src >= 0 ? from.nodes[item.src].sum[q] : item.energy / 4;
+            if (e / t <= threshold || item.depth >= maxDTreeDepth)
+                continue;
+            int src = item.src >= 0 && from.nodes[item.src].child[q] != 0 ? (int)from.nodes[item.src].child[q] : -1;
+            uint32_t child = nodes.size();
+            nodes.emplace_back();
+            nodes[item.dst].child[q] = child;
+            stack.push_back({child, src, e, item.depth + 1});
+        }
+    }
+}
+
+STree::STree(const Bounds3 &sceneBounds) : nodes(1), dtrees(1)
+{
+    // a cube around the scene so every split halves all cells alike
+    Vector3f c = (sceneBounds.pMin + sceneBounds.pMax) * 0.5f;
+    Vector3f d = sceneBounds.Diagonal();
+    float half = std::max(d.x, std::max(d.y, d.z)) * 0.5f * 1.001f + EPSILON;
+    bounds = Bounds3(c - Vector3f(half), c + Vector3f(half));
+}
+
+DTreeWrapper &STree::lookup(const Vector3f &p)
+{
+    Vector3f q = bounds.Offset(p);
+    q = Vector3f(clamp(0, OneMinusEpsilon, q.x), clamp(0, OneMinusEpsilon, q.y), clamp(0, OneMinusEpsilon, q.z));
+    uint32_t idx = 0;
+    while (nodes[idx].child[0] != 0) {
+        float &c = q[nodes[idx].axis];
+        if (c < 0.5f) {
+            c = c * 2;
+            idx = nodes[idx].child[0];
+        } else {
+            c = c * 2 - 1;
+            idx = nodes[idx].child[1];
+        }
+    }
+    return dtrees[nodes[idx].dtree];
+}
+
+void STree::split(uint32_t node)
+{
+    uint32_t dtree = nodes[node].dtree;
+    int axis = (nodes[node].axis + 1) % 3;
+    dtrees[dtree].building.sampleCount /= 2;
+    dtrees.push_back(dtrees[dtree]);
+
+    uint32_t c0 = nodes.size();
+    nodes.resize(nodes.size() + 2);
+    nodes[c0].axis = axis;
+    nodes[c0].dtree = dtree;
+    nodes[c0 + 1].axis = axis;
+    nodes[c0 + 1].dtree = dtrees.size() - 1;
+    nodes[node].child = {c0, c0 + 1};
+}
+
+void STree::refine(unsigned long long splitCount, float dtreeThreshold)
+{
+    std::vector<std::pair<uint32_t, int>> stack{{0, 0}};
+    while (!stack.empty()) {
+        auto [idx, depth] = stack.back();
+        stack.pop_back();
+        if (nodes[idx].child[0] != 0) {
+            stack.push_back({nodes[idx].child[0], depth + 1});
+            stack.push_back({nodes[idx].child[1], depth + 1});
+        } else if (depth < maxSTreeDepth && dtrees[nodes[idx].dtree].building.sampleCount > splitCount) {
+            split(idx);
+            stack.push_back({nodes[idx].child[0], depth + 1});
+            stack.push_back({nodes[idx].child[1], depth + 1});
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t k = 0; k < dtrees.size(); ++k) {
+        DTreeWrapper &w = dtrees[k];
+        w.sampling = w.building;
+        w.building.refineFrom(w.sampling, dtreeThreshold);
+    }
+}
+
+GuidedPathIntegrator::GuidedPathIntegrator(const Scene &scene, const Camera &camera)
+    : scene(scene), camera(camera), sdTree(scene.bvh->WorldBound())
+{}
+
+bool GuidedPathIntegrator::renderImage(std::vector<Vector3f> &framebuffer, const Sampler &samplerProto,
+                                       int spp) const
+{
+    const int width = camera.width, height = camera.height;
+    // passes of 1, 2, 4, ... samples; every pass is an unbiased estimate,
+    // so all of them go into the image
+    int done = 0;
+    for (int pass = 0; done < spp; ++pass) {
+        const int passSpp = std::min(1 << std::min(pass, 30), spp - done);
+        #pragma omp parallel
+        {
+            std::unique_ptr<Sampler> sampler = samplerProto.clone();
+            #pragma omp for schedule(dynamic, 4)
+            for (int j = 0; j < height; ++j) {
+                for (int i = 0; i < width; ++i) {
+                    Vector3f radiance;
+                    for (int k = done; k < done + passSpp; ++k) {
+                        sampler->startPixelSample(i, j, k);
+                        Vector2f jitter = sampler->getPixel2D();
+                        radiance += Li(camera.generateRay(i + jitter.x, j + jitter.y), *sampler);
+                    }
+                    framebuffer[j * width + i] += radiance / spp;
+                }
+            }
+        }
+        done += passSpp;
+        if (done < spp)
+            sdTree.refine((unsigned long long)(spatialThreshold * std::sqrt((float)(1 << std::min(pass, 30)))),
+                          directionalThreshold);
+        UpdateProgress(done / (float)spp);
+    }
+    return true;
+}
+
+Vector3f GuidedPathIntegrator::Li(const Ray &cameraRay, Sampler &sampler) const
+{
+    // vertices whose sampled direction gets the radiance found further down the path
+    struct GuidedVertex
+    {
+        DTreeWrapper *dtree;
+        Vector3f dir, throughput, radiance;
+        float pdf;
+    };
+    thread_local std::vector<GuidedVertex> vertices;
+    vertices.clear();
+
+    Vector3f L;
+    auto addRadiance = [&](const Vector3f &c) {
+        L += c;
+        for (auto &v : vertices)
+            v.radiance += divide(c, v.throughput);
+    };
+
+    const float alpha = bsdfSamplingFraction;
+    const float rr = scene.RussianRoulette;
+    Ray ray = cameraRay;
+    Vector3f beta(1.0f);
+    float prevPdf = 0.0f;
+    bool prevDelta = true;
+    Vector3f prevP, prevN; // last scattering vertex, for the light pdf
+    for (int depth = 0; depth < maxDepth; ++depth) {
+        Intersection isect = scene.intersect(ray);
+        if (!isect.happened)
+            break;
+        Material &m = *isect.m;
+        if (m.hasEmission()) {
+            float w = 1.0f;
+            if (!prevDelta) {
+                float cosLight = dotProduct(-ray.direction, isect.normal);
+                w = cosLight > 0 ? powerHeuristic(prevPdf, scene.pdfLight(prevP, prevN, isect) * isect.distance * isect.distance / cosLight)
+                                 : 0.0f;
+            }
+            addRadiance(beta * m.getEmission() * w);
+            break;
+        }
+
+        const Frame frame(isect.normal);
+        const bool guided = m.getType() != MIRROR;
+        DTreeWrapper *dtree = guided ? &sdTree.lookup(isect.coords) : nullptr;
+
+        if (guided) {
+            // light sample, MIS'd against the mixture the path itself samples
+            Intersection lightInter;
+            float lightPdf = 0.0f;
+            scene.sampleLight(isect.coords, isect.normal, lightInter, lightPdf, sampler.get2D());
+            Vector3f toLight = lightInter.coords - isect.coords;
+            float dist2 = dotProduct(toLight, toLight);
+            Vector3f dir = toLight / std::sqrt(dist2);
+            float cosLight = dotProduct(-dir, lightInter.normal);
+            float cosSurface = frame.cosTheta(dir);
+            if (lightPdf > 0 && cosLight > 0 && cosSurface > 0 && scene.visible(isect.coords, lightInter.coords)) {
+                float lightPdfW = lightPdf * dist2 / cosLight;
+                float mixPdf = alpha * m.pdf(ray.direction, dir, frame) + (1 - alpha) * dtree->sampling.pdf(dir);
+                float w = powerHeuristic(lightPdfW, mixPdf);
+                addRadiance(beta * lightInter.emit * m.eval(ray.direction, dir, frame) * (cosSurface * w / lightPdfW));
+                dtree->building.record(dir, average(lightInter.emit) * w / lightPdfW);
+            }
+        }
+
+        if (sampler.get1D() > rr)
+            break;
+
+        Vector3f wo, weight;
+        float pdf;
+        if (guided) {
+            float uPick = sampler.get1D();
+            Vector2f u = sampler.get2D();
+            if (uPick < alpha) {
+                BSDFSample bs = m.sample(ray.direction, frame, u);
+                if (bs.pdf <= 0)
+                    break;
+                wo = bs.wo;
+            } else {
+                wo = dtree->sampling.sample(u);
+            }
+            pdf = alpha * m.pdf(ray.direction, wo, frame) + (1 - alpha) * dtree->sampling.pdf(wo);
+            float cosTheta = frame.cosTheta(wo);
+            if (pdf <= 0 || cosTheta <= 0)
+                break;
+            weight = m.eval(ray.direction, wo, frame) * (cosTheta / pdf);
+        } else {
+            BSDFSample bs = m.sample(ray.direction, frame, sampler.get2D());
+            if (bs.pdf <= 0)
+                break;
+            wo = bs.wo;
+            pdf = bs.pdf;
+            weight = bs.weight;
+        }
+        beta *= weight / rr;
+        if (guided)
+            vertices.push_back({dtree, wo, beta, Vector3f(), pdf});
+        prevPdf = pdf;
+        prevDelta = !guided;
+        prevP = isect.coords;
+        prevN = isect.normal;
+        ray = Ray(isect.coords, wo);
+    }
+
+    for (auto &v : vertices)
+        v.dtree->building.record(v.dir, average(v.radiance) / v.pdf);
+    return L;
+}
@@ -0,0 +1,101 @@
+//
+// Practical path guiding (Mueller et al. 2017): an SD-tree learns the
+// incident radiance field online. A binary tree over the scene bounds holds,
+// in each leaf, a quadtree over the sphere of directions; paths sample it
+// mixed 50/50 with the BSDF and feed their radiance back into it. Training
+// runs in passes of doubling sample counts, each pass sampling from the
+// distribution learned in the previous one.
+//
+
+#ifndef RAYTRACING_GUIDING_H
+#define RAYTRACING_GUIDING_H
+
+#include <array>
+#include <vector>
+#include "Integrator.hpp"
+
+// Quadtree over the square [0,1]^2, mapped to the sphere by the
+// area-preserving cylindrical map (cos theta = 2u - 1, phi = 2 pi v).
+class DTree
+{
+public:
+    DTree();
+
+    void record(const Vector3f &dir, float value);
+    Vector3f sample(const Vector2f &u) const;
+    float pdf(const Vector3f &dir) const;
+
+    // Rebuilds the node structure from the energy recorded in `from`:
+    // quadrants holding more than `threshold` of the total are split, the
+    // rest collapsed. Sums are cleared.
+    void refineFrom(const DTree &from, float threshold);
+
+    float total() const { return nodes[0].sum[0] + nodes[0].sum[1] + nodes[0].sum[2] + nodes[0].sum[3]; }
+    unsigned long long sampleCount = 0;
+
+private:
+    struct Node
+    {
+        std::array<float, 4> sum{};
+        std::array<uint32_t, 4> child{}; // 0: leaf quadrant
+    };
+
+    static Vector2f toSquare(const Vector3f &dir);
+    static Vector3f toSphere(const Vector2f &p);
+
+    std::vector<Node> nodes;
+};
+
+struct DTreeWrapper
+{
+    DTree sampling;  // learned in the previous pass
+    DTree building;  // being learned now
+};
+
+// Binary tree over the (cubified) scene bounds.
+class STree
+{
+public:
+    explicit STree(const Bounds3 &sceneBounds);
+
+    DTreeWrapper &lookup(const Vector3f &p);
+    // After a pass: splits leaves that received more than `splitCount`
+    // samples, then turns each building tree into the next sampling tree.
+    void refine(unsigned long long splitCount, float dtreeThreshold);
+
+private:
+    struct Node
+    {
+        int axis = 0;
+        std::array<uint32_t, 2> child{}; // 0: leaf
+        uint32_t dtree = 0;
+    };
+
+    void split(uint32_t node);
+
+    Bounds3 bounds;
+    std::vector<Node> nodes;
+    std::vector<DTreeWrapper> dtrees;
+};
+
+class GuidedPathIntegrator : public Integrator
+{
+public:
+    GuidedPathIntegrator(const Scene &scene, const Camera &camera);
+
+    // Guiding needs the pass structure; Li alone traces with the current tree.
+    Vector3f Li(const Ray &ray, Sampler &sampler) const override;
+    bool renderImage(std::vector<Vector3f> &framebuffer, const Sampler &sampler, int spp) const override;
+
+    int maxDepth = 20;
+    float bsdfSamplingFraction = 0.5f;
+    unsigned long long spatialThreshold = 4000; // scaled by sqrt(2^pass)
+    float directionalThreshold = 0.01f;
+
+private:
+    const Scene &scene;
+    const Camera &camera;
+    mutable STree sdTree;
+};
+
+#endif //RAYTRACING_GUIDING_H
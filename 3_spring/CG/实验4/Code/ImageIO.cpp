@@ -0,0 +1,256 @@
+//
+// Image output.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ImageIO.hpp"
+#include "Profiler.hpp"
+
+namespace {
+
+template <typename T>
+void put(std::vector<char> &buf, const T &v)
+{
+    const char *p = reinterpret_cast<const char*>(&v);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+void putString(std::vector<char> &buf, const char *s)
+{
+    buf.insert(buf.end(), s, s + std::strlen(s) + 1);
+}
+
+void putAttribute(std::vector<char> &buf, const char *name, const char *type, const std::vector<char> &value)
+{
+    putString(buf, name);
+    putString(buf, type);
+    put(buf, (int32_t)value.size());
+    buf.insert(buf.end(), value.begin(), value.end());
+}
+
+bool writeAll(int fd, const void *data, size_t size, off_t offset)
+{
+    const char *p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+}
+
+ToneMapper::ToneMapper(float gamma, int size) : lut(size + 1), scale((float)size)
+{
+    for (int i = 0; i <= size; ++i)
+        lut[i] = (unsigned char)(255 * std::pow(i / (float)size, gamma));
+}
+
+void ToneMapper::apply(const Vector3f *in, unsigned char *out, size_t n) const
+{
+    PROFILE_ZONE("tonemap");
+    for (size_t i = 0; i < n; ++i) {
+        out[3 * i] = (*this)(in[i].x);
+        out[3 * i + 1] = (*this)(in[i].y);
+        out[3 * i + 2] = (*this)(in[i].z);
+    }
+}
+
+bool writePPM(const char *filename, const std::vector<Vector3f> &image, int width, int height, float gamma)
+{
+    PROFILE_ZONE("writePPM");
+    ToneMapper tonemap(gamma);
+    std::vector<unsigned char> bytes(3 * (size_t)width * height);
+    #pragma omp parallel for schedule(static, 16)
+    for (int y = 0; y < height; ++y)
+        tonemap.apply(&image[(size_t)y * width], &bytes[3 * (size_t)y * width], width);
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp)
+        return false;
+    (void)fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+    return fclose(fp) == 0 && ok;
+}
+
+bool writePFM(const char *filename, const std::vector<Vector3f> &image, int width, int height)
+{
+    PROFILE_ZONE("writePFM");
+    FILE* fp = fopen(filename, "wb");
+    if (!fp)
+        return false;
+    // negative scale: little endian
+    (void)fprintf(fp, "PF\n%d %d\n-1.0\n", width, height);
+    std::vector<float> row(3 * width);
+    bool ok = true;
+    for (int y = height - 1; y >= 0 && ok; --y) {
+        for (int x = 0; x < width; ++x) {
+            const Vector3f &v = image[(size_t)y * width + x];
+            row[3 * x] = v.x;
+            row[3 * x + 1] = v.y;
+            row[3 * x + 2] = v.z;
+        }
+        ok = fwrite(row.data(), sizeof(float), row.size(), fp) == row.size();
+    }
+    return fclose(fp) == 0 && ok;
+}
+
+bool writeEXR(const char *filename, const std::vector<Vector3f> &image, int width, int height)
+{
+    PROFILE_ZONE("writeEXR");
+    std::vector<char> file;
+    put(file, (int32_t)20000630); // magic
+    put(file, (int32_t)2);        // version 2, single part scanline
+
+    std::vector<char> channels;
+    for (const char *name : {"B", "G", "R"}) {
+        putString(channels, name);
+        put(channels, (int32_t)2); // FLOAT
+        put(channels, (int32_t)0); // pLinear and reserved
+        put(channels, (int32_t)1); // x sampling
+        put(channels, (int32_t)1); // y sampling
+    }
+    channels.push_back(0);
+    putAttribute(file, "channels", "chlist", channels);
+    putAttribute(file, "compression", "compression", {0});
+    std::vector<char> box;
+    put(box, (int32_t)0);
+    put(box, (int32_t)0);
+    put(box, (int32_t)(width - 1));
+    put(box, (int32_t)(height - 1));
+    putAttribute(file, "dataWindow", "box2i", box);
+    putAttribute(file, "displayWindow", "box2i", box);
+    putAttribute(file, "lineOrder", "lineOrder", {0});
+    std::vector<char> value;
+    put(value, 1.0f);
+    putAttribute(file, "pixelAspectRatio", "float", value);
+    value.clear();
+    put(value, 0.0f);
+    put(value, 0.0f);
+    putAttribute(file, "screenWindowCenter", "v2f", value);
+    value.clear();
+    put(value, 1.0f);
+    putAttribute(file, "screenWindowWidth", "float", value);
+    file.push_back(0);
+
+    // offset table, then one block per scanline: y, size, B row, G row, R row
+    const size_t lineBytes = 3 * sizeof(float) * width;
+    const size_t tableStart = file.size();
+    for (int y = 0; y < height; ++y)
+        put(file, (uint64_t)(tableStart + 8 * (size_t)height + y * (8 + lineBytes)));
+    for (int y = 0; y < height; ++y) {
+        put(file, (int32_t)y);
+        put(file, (int32_t)lineBytes);
+        for (int c = 2; c >= 0; --c)
+            for (int x = 0; x < width; ++x)
+                put(file, (float)image[(size_t)y * width + x][c]);
+    }
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp)
+        return false;
+    bool ok = fwrite(file.data(), 1, file.size(), fp) == file.size();
+    return fclose(fp) == 0 && ok;
+}
+
+ImageWriter::ImageWriter(const std::string &base, const std::vector<Vector3f> &framebuffer, int width, int height,
+                         float gamma)
+    : framebuffer(framebuffer), width(width), height(height), tonemap(gamma)
+{
+    char header[64];
+    ppm = open((base + ".ppm").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ppm >= 0) {
+        ppmHeader = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+        failed |= !writeAll(ppm, header, ppmHeader, 0) || ftruncate(ppm, ppmHeader + 3L * width * height) != 0;
+    }
+    pfm = open((base + ".pfm").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (pfm >= 0) {
+        pfmHeader = snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height);
+        failed |= !writeAll(pfm, header, pfmHeader, 0) || ftruncate(pfm, pfmHeader + 12L * width * height) != 0;
+    }
+    failed |= ppm < 0 || pfm < 0;
+    worker = std::thread(&ImageWriter::run, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    close();
+}
+
+void ImageWriter::rowsDone(int y0, int y1)
+{
+    Rows rows{ y0, y1, std::vector<Vector3f>(framebuffer.begin() + (size_t)y0 * width,
+                                             framebuffer.begin() + (size_t)y1 * width) };
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        queue.push_back(std::move(rows));
+    }
+    cv.notify_one();
+}
+
+bool ImageWriter::close()
+{
+    if (!worker.joinable())
+        return !failed;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        closing = true;
+    }
+    cv.notify_one();
+    worker.join();
+    if (ppm >= 0)
+        failed |= ::close(ppm) != 0;
+    if (pfm >= 0)
+        failed |= ::close(pfm) != 0;
+    return !failed;
+}
+
+void ImageWriter::run()
+{
+    profiler::nameThread("image writer");
+    std::vector<unsigned char> bytes;
+    std::vector<float> floats;
+    while (true) {
+        Rows rows;
+        {
+            std::unique_lock<std::mutex> guard(mutex);
+            cv.wait(guard, [this] { return closing || !queue.empty(); });
+            if (queue.empty())
+                return;
+            rows = std::move(queue.front());
+            queue.pop_front();
+        }
+        writeRows(rows, bytes, floats);
+    }
+}
+
+void ImageWriter::writeRows(const Rows &rows, std::vector<unsigned char> &bytes, std::vector<float> &floats)
+{
+    PROFILE_ZONE("write rows", rows.y0);
+    bytes.resize(3 * (size_t)width);
+    floats.resize(3 * (size_t)width);
+    for (int y = rows.y0; y < rows.y1; ++y) {
+        const Vector3f *row = &rows.pixels[(size_t)(y - rows.y0) * width];
+        if (ppm >= 0) {
+            tonemap.apply(row, bytes.data(), width);
+            failed |= !writeAll(ppm, bytes.data(), bytes.size(), ppmHeader + 3L * width * y);
+        }
+        if (pfm >= 0) {
+            for (int x = 0; x < width; ++x) {
+                floats[3 * x] = row[x].x;
+                floats[3 * x + 1] = row[x].y;
+                floats[3 * x + 2] = row[x].z;
+            }
+            failed |= !writeAll(pfm, floats.data(), floats.size() * sizeof(float),
+                                pfmHeader + 12L * width * (height - 1 - y));
+        }
+    }
+}
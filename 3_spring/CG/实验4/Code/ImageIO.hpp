@@ -0,0 +1,83 @@
+//
+// Image output: LUT tonemapping, PPM/PFM/EXR writers and a background
+// writer that streams finished rows to disk while rendering continues.
+//
+
+#ifndef RAYTRACING_IMAGEIO_H
+#define RAYTRACING_IMAGEIO_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Vector.hpp"
+
+// clamp(v, 0, 1)^gamma * 255 through a table instead of std::pow.
+class ToneMapper
+{
+public:
+    explicit ToneMapper(float gamma, int size = 4096);
+
+    unsigned char operator()(float v) const
+    {
+        v = v > 0 ? (v < 1 ? v : 1) : 0;
+        return lut[(int)(v * scale + 0.5f)];
+    }
+    void apply(const Vector3f *in, unsigned char *out, size_t n) const;
+
+private:
+    std::vector<unsigned char> lut;
+    float scale;
+};
+
+// Whole-image writers; the tonemapping is split across threads.
+bool writePPM(const char *filename, const std::vector<Vector3f> &image, int width, int height, float gamma);
+// Raw linear values. PFM stores the rows bottom to top.
+bool writePFM(const char *filename, const std::vector<Vector3f> &image, int width, int height);
+// Uncompressed 32-bit float scanline OpenEXR with B, G, R channels.
+bool writeEXR(const char *filename, const std::vector<Vector3f> &image, int width, int height);
+
+// Writes <base>.ppm and <base>.pfm row by row from a worker-owned
+// framebuffer. Both files have fixed-size rows, so every row is written in
+// place with pwrite as soon as it is announced, in any order. Announced
+// rows are copied, since progressive passes keep updating them.
+class ImageWriter
+{
+public:
+    ImageWriter(const std::string &base, const std::vector<Vector3f> &framebuffer, int width, int height,
+                float gamma);
+    ~ImageWriter();
+
+    // Rows [y0, y1) are final until announced again; copies them and returns.
+    void rowsDone(int y0, int y1);
+    // Waits until everything announced so far is on disk and closes the
+    // files. False if either file could not be written completely.
+    bool close();
+
+private:
+    void run();
+    struct Rows {
+        int y0, y1;
+        std::vector<Vector3f> pixels;
+    };
+
+    void writeRows(const Rows &rows, std::vector<unsigned char> &bytes, std::vector<float> &floats);
+
+    const std::vector<Vector3f> &framebuffer;
+    const int width, height;
+    ToneMapper tonemap;
+    int ppm = -1, pfm = -1;
+    long ppmHeader = 0, pfmHeader = 0;
+    // set by the constructor, then only by the writer thread until close()
+    bool failed = false;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Rows> queue;
+    bool closing = false;
+    std::thread worker;
+};
+
+#endif //RAYTRACING_IMAGEIO_H
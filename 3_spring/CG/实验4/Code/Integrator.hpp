@@ -0,0 +1,40 @@
+//
+// Light transport algorithms selectable by the Renderer.
+//
+
+#ifndef RAYTRACING_INTEGRATOR_H
+#define RAYTRACING_INTEGRATOR_H
+
+#include "Scene.hpp"
+#include "Camera.hpp"
+#include "Sampler.hpp"
+
+enum class RenderMode { PathTracing, BDPT, SPPM, Guided, ReSTIR, IrradianceCache };
+
+class Integrator
+{
+public:
+    virtual ~Integrator() = default;
+    // Radiance arriving at the camera along a primary ray.
+    virtual Vector3f Li(const Ray &ray, Sampler &sampler) const = 0;
+    // Called once after all pixels are done; adds any contributions that were
+    // splatted to arbitrary pixels (e.g. light tracing) into the image.
+    // Returns true if the framebuffer changed.
+    virtual bool finish(std::vector<Vector3f> &framebuffer, int spp) const { return false; }
+    // Integrators that work in whole-image passes (photon mapping) fill the
+    // framebuffer themselves and return true; spp is their pass count.
+    virtual bool renderImage(std::vector<Vector3f> &framebuffer, const Sampler &sampler, int spp) const { return false; }
+};
+
+// The unidirectional path tracer in Scene::castRay.
+class PathIntegrator : public Integrator
+{
+public:
+    explicit PathIntegrator(const Scene &scene) : scene(scene) {}
+    Vector3f Li(const Ray &ray, Sampler &sampler) const override { return scene.castRay(ray, 0, sampler); }
+
+private:
+    const Scene &scene;
+};
+
+#endif //RAYTRACING_INTEGRATOR_H
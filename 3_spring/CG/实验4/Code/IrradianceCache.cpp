@@ -0,0 +1,264 @@
+//
+// Irradiance cache and the path tracer that uses it.
+//
+
+#include <mutex>
+#include "IrradianceCache.hpp"
+
+namespace {
+
+const int maxOctreeDepth = 16;
+
+inline bool overlaps(const Bounds3 &a, const Bounds3 &b)
+{
+    return a.pMax.x >= b.pMin.x && a.pMin.x <= b.pMax.x
+        && a.pMax.y >= b.pMin.y && a.pMin.y <= b.pMax.y
+        && a.pMax.z >= b.pMin.z && a.pMin.z <= b.pMax.z;
+}
+
+inline bool inside(const Vector3f &p, const Bounds3 &b)
+{
+    return p.x >= b.pMin.x && p.x <= b.pMax.x && p.y >= b.pMin.y
+        && p.y <= b.pMax.y && p.z >= b.pMin.z && p.z <= b.pMax.z;
+}
+
+inline Bounds3 octant(const Bounds3 &b, int i)
+{
+    Vector3f c = (b.pMin + b.pMax) * 0.5f;
+    return Bounds3(Vector3f(i & 1 ? c.x : b.pMin.x, i & 2 ? c.y : b.pMin.y, i & 4 ? c.z : b.pMin.z),
+                   Vector3f(i & 1 ? b.pMax.x : c.x, i & 2 ? b.pMax.y : c.y, i & 4 ? b.pMax.z : c.z));
+}
+
+inline int octantOf(const Bounds3 &b, const Vector3f &p)
+{
+    Vector3f c = (b.pMin + b.pMax) * 0.5f;
+    return (p.x > c.x) | (p.y > c.y) << 1 | (p.z > c.z) << 2;
+}
+
+}
+
+IrradianceCache::IrradianceCache(const Bounds3 &sceneBounds, float maxError)
+    : maxError(maxError)
+{
+    // hit points on the outermost walls land a hair outside the scene bounds
+    Vector3f margin = sceneBounds.Diagonal() * 0.001f + Vector3f(EPSILON);
+    bounds = Bounds3(sceneBounds.pMin - margin, sceneBounds.pMax + margin);
+}
+
+void IrradianceCache::add(const Record &record)
+{
+    // a record is used where its weight exceeds 1 / maxError, i.e. within
+    // maxError * R of its position
+    float r = maxError * record.R;
+    Bounds3 recordBounds(record.p - Vector3f(r), record.p + Vector3f(r));
+    std::unique_lock<std::shared_mutex> guard(mutex);
+    insert(root, bounds, record, recordBounds, 0);
+    ++count;
+}
+
+void IrradianceCache::insert(Node &node, const Bounds3 &nodeBounds, const Record &record,
+                             const Bounds3 &recordBounds, int depth)
+{
+    // stop at the level whose cells are about the size of the record, and
+    // store it in every cell it reaches into
+    Vector3f d = nodeBounds.Diagonal();
+    float recordSize = recordBounds.pMax.x - recordBounds.pMin.x;
+    if (depth == maxOctreeDepth || std::max(d.x, std::max(d.y, d.z)) < 2 * recordSize) {
+        node.records.push_back(record);
+        return;
+    }
+    for (int i = 0; i < 8; ++i) {
+        Bounds3 childBounds = octant(nodeBounds, i);
+        if (!overlaps(childBounds, recordBounds))
+            continue;
+        if (!node.child[i])
+            node.child[i] = std::make_unique<Node>();
+        insert(*node.child[i], childBounds, record, recordBounds, depth + 1);
+    }
+}
+
+bool IrradianceCache::lookup(const Vector3f &p, const Vector3f &n, Vector3f &E) const
+{
+    if (!inside(p, bounds))
+        return false;
+    std::shared_lock<std::shared_mutex> guard(mutex);
+    Vector3f sum;
+    float weightSum = 0.0f;
+    const Node *node = &root;
+    Bounds3 nodeBounds = bounds;
+    while (node) {
+        for (const Record &rec : node->records) {
+            Vector3f d = p - rec.p;
+            // records in front of p see a different neighbourhood
+            if (dotProduct(d, n + rec.n) < -0.01f * rec.R)
+                continue;
+            float cosN = dotProduct(n, rec.n);
+            if (cosN <= 0)
+                continue;
+            float w = 1.0f / std::max(1e-4f, d.norm() / rec.R + std::sqrt(std::max(0.0f, 1.0f - cosN)));
+            if (w <= 1.0f / maxError)
+                continue;
+            Vector3f axis = crossProduct(rec.n, n);
+            Vector3f e = rec.E;
+            for (int c = 0; c < 3; ++c)
+                e[c] += dotProduct(axis, rec.rotGrad[c]) + dotProduct(d, rec.transGrad[c]);
+            sum += Vector3f(std::max(0.0f, e.x), std::max(0.0f, e.y), std::max(0.0f, e.z)) * w;
+            weightSum += w;
+        }
+        int i = octantOf(nodeBounds, p);
+        nodeBounds = octant(nodeBounds, i);
+        node = node->child[i].get();
+    }
+    if (weightSum <= 0)
+        return false;
+    E = sum / weightSum;
+    return true;
+}
+
+IrradianceCacheIntegrator::IrradianceCacheIntegrator(const Scene &scene, const Camera &camera)
+    : scene(scene), cache(scene.bvh->WorldBound(), 0.3f)
+{
+    pixelAngle = 2 * camera.scale / camera.height;
+}
+
+bool IrradianceCacheIntegrator::finish(std::vector<Vector3f> &framebuffer, int spp) const
+{
+    std::cout << "\nIrradiance cache records: " << cache.size() << "\n";
+    return false;
+}
+
+Vector3f IrradianceCacheIntegrator::directLight(const Intersection &isect, const Vector3f &wi, Sampler &sampler) const
+{
+    // plain light sampling: emitters reached by hemisphere rays are not
+    // counted in the cache, so no MIS is needed here
+    Intersection lightInter;
+    float lightPdf = 0.0f;
+    scene.sampleLight(isect.coords, isect.normal, lightInter, lightPdf, sampler.get2D());
+    Vector3f toLight = lightInter.coords - isect.coords;
+    float dist2 = dotProduct(toLight, toLight);
+    Vector3f dir = toLight / std::sqrt(dist2);
+    Frame frame(isect.normal);
+    float cosLight = dotProduct(-dir, lightInter.normal);
+    float cosSurface = frame.cosTheta(dir);
+    if (lightPdf <= 0 || cosLight <= 0 || cosSurface <= 0 || !scene.visible(isect.coords, lightInter.coords))
+        return Vector3f();
+    return lightInter.emit * isect.m->eval(wi, dir, frame) * (cosSurface * cosLight / (dist2 * lightPdf));
+}
+
+IrradianceCache::Record IrradianceCacheIntegrator::computeRecord(const Vector3f &p, const Vector3f &n,
+                                                                 float pathLength, Sampler &sampler) const
+{
+    const int M = thetaStrata, N = phiStrata;
+    // a record is used out to maxError * R
+    const float pixelSize = pathLength * pixelAngle;
+    const float minRadius = minPixelRadius * pixelSize / cache.maxError;
+    const float maxRadius = maxPixelRadius * pixelSize / cache.maxError;
+    const Frame frame(n);
+    std::vector<Vector3f> L(M * N);
+    std::vector<float> dist(M * N), tanTheta(M * N);
+    float invDistSum = 0.0f;
+
+    // cosine-weighted, stratified in (sin^2 theta, phi)
+    for (int j = 0; j < M; ++j) {
+        for (int k = 0; k < N; ++k) {
+            Vector2f u = sampler.get2D();
+            float sin2 = (j + u.x) / M;
+            float sinTheta = std::sqrt(sin2), cosTheta = std::sqrt(std::max(0.0f, 1 - sin2));
+            float phi = 2 * M_PI * (k + u.y) / N;
+            Ray ray(p, frame.toWorld(Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta)));
+            Intersection hit = scene.intersect(ray);
+            int idx = j * N + k;
+            tanTheta[idx] = sinTheta / std::max(cosTheta, 1e-4f);
+            dist[idx] = hit.happened ? std::max((float)hit.distance, minRadius) : maxRadius;
+            invDistSum += 1.0f / dist[idx];
+            // only indirect light; emitters are covered by directLight()
+            if (hit.happened && !hit.m->hasEmission())
+                L[idx] = scene.shade(ray, hit, 1, sampler);
+        }
+    }
+
+    IrradianceCache::Record rec;
+    rec.p = p;
+    rec.n = n;
+    for (auto &l : L)
+        rec.E += l;
+    rec.E = rec.E * (M_PI / (M * N));
+
+    for (int k = 0; k < N; ++k) {
+        // rotational: tangent direction of the phi stratum centre
+        float phiK = 2 * M_PI * (k + 0.5f) / N;
+        Vector3f vK = frame.toWorld(Vector3f(-std::sin(phiK), std::cos(phiK), 0));
+        Vector3f rot;
+        for (int j = 0; j < M; ++j)
+            rot -= L[j * N + k] * tanTheta[j * N + k];
+        // translational: change across theta and across phi stratum borders
+        Vector3f uK = frame.toWorld(Vector3f(std::cos(phiK), std::sin(phiK), 0));
+        float phiKm = 2 * M_PI * k / N;
+        Vector3f vKm = frame.toWorld(Vector3f(-std::sin(phiKm), std::cos(phiKm), 0));
+        Vector3f acrossTheta, acrossPhi;
+        int km = (k + N - 1) % N;
+        for (int j = 0; j < M; ++j) {
+            float cosMinus = std::sqrt(1 - j / (float)M);
+            if (j > 0) {
+                float sinMinus = std::sqrt(j / (float)M);
+                float r = std::min(dist[j * N + k], dist[(j - 1) * N + k]);
+                acrossTheta += (L[j * N + k] - L[(j - 1) * N + k]) * (sinMinus * cosMinus * cosMinus / r);
+            }
+            float cosPlus = std::sqrt(std::max(0.0f, 1 - (j + 1) / (float)M));
+            float sinMid = std::sqrt((j + 0.5f) / M);
+            float r = std::min(dist[j * N + k], dist[j * N + km]);
+            acrossPhi += (L[j * N + k] - L[j * N + km]) * ((cosMinus - cosPlus) / (sinMid * r));
+        }
+        for (int c = 0; c < 3; ++c) {
+            rec.rotGrad[c] += vK * (rot[c] * M_PI / (M * N));
+            rec.transGrad[c] += uK * (acrossTheta[c] * 2 * M_PI / N) + vKm * acrossPhi[c];
+        }
+    }
+
+    rec.R = clamp(minRadius, maxRadius, M * N / invDistSum);
+    // keep the first-order extrapolation from overshooting within R
+    float gradMax = 0.0f;
+    for (int c = 0; c < 3; ++c)
+        gradMax = std::max(gradMax, rec.transGrad[c].norm());
+    float e = (rec.E.x + rec.E.y + rec.E.z) / 3;
+    if (gradMax > 0 && e > 0)
+        rec.R = std::max(minRadius, std::min(rec.R, e / gradMax));
+    return rec;
+}
+
+Vector3f IrradianceCacheIntegrator::Li(const Ray &cameraRay, Sampler &sampler) const
+{
+    Ray ray = cameraRay;
+    Vector3f beta(1.0f);
+    float pathLength = 0.0f;
+    for (int depth = 0; depth < maxDepth; ++depth) {
+        Intersection isect = scene.intersect(ray);
+        if (!isect.happened)
+            return Vector3f();
+        pathLength += isect.distance;
+        if (isect.m->hasEmission())
+            return beta * isect.m->getEmission();
+        switch (isect.m->getType()) {
+            case MIRROR: {
+                BSDFSample bs = isect.m->sample(ray.direction, Frame(isect.normal), sampler.get2D());
+                if (bs.pdf <= 0)
+                    return Vector3f();
+                beta *= bs.weight;
+                ray = Ray(isect.coords, bs.wo);
+                break;
+            }
+            case DIFFUSE: {
+                Vector3f E;
+                if (!cache.lookup(isect.coords, isect.normal, E)) {
+                    IrradianceCache::Record rec = computeRecord(isect.coords, isect.normal, pathLength, sampler);
+                    cache.add(rec);
+                    E = rec.E;
+                }
+                return beta * (directLight(isect, ray.direction, sampler) + isect.m->Kd * E / M_PI);
+            }
+            default:
+                return beta * scene.shade(ray, isect, depth, sampler);
+        }
+    }
+    return Vector3f();
+}
@@ -0,0 +1,82 @@
+//
+// Irradiance caching (Ward et al. 1988) with translational and rotational
+// gradients (Ward & Heckbert 1992). Indirect irradiance is computed at a
+// sparse set of diffuse points and interpolated in between; records live
+// in an octree and are added lazily by whichever thread first misses.
+//
+
+#ifndef RAYTRACING_IRRADIANCECACHE_H
+#define RAYTRACING_IRRADIANCECACHE_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+#include "Integrator.hpp"
+
+class IrradianceCache
+{
+public:
+    struct Record
+    {
+        Vector3f p, n, E;
+        float R = 0.0f;                     // harmonic mean distance to the surroundings
+        std::array<Vector3f, 3> rotGrad;    // per colour channel
+        std::array<Vector3f, 3> transGrad;
+    };
+
+    IrradianceCache(const Bounds3 &sceneBounds, float maxError);
+
+    // Interpolated irradiance at (p, n); false if no record is close enough.
+    bool lookup(const Vector3f &p, const Vector3f &n, Vector3f &E) const;
+    void add(const Record &record);
+    size_t size() const { return count; }
+
+    const float maxError;
+
+private:
+    struct Node
+    {
+        std::vector<Record> records;
+        std::array<std::unique_ptr<Node>, 8> child;
+    };
+
+    void insert(Node &node, const Bounds3 &nodeBounds, const Record &record, const Bounds3 &recordBounds, int depth);
+
+    Bounds3 bounds;
+    Node root;
+    mutable std::shared_mutex mutex;
+    std::atomic<size_t> count{0};
+};
+
+// Path tracing that replaces the indirect part at the first diffuse hit by
+// a cache lookup, computing a new record on a miss.
+class IrradianceCacheIntegrator : public Integrator
+{
+public:
+    IrradianceCacheIntegrator(const Scene &scene, const Camera &camera);
+
+    Vector3f Li(const Ray &ray, Sampler &sampler) const override;
+    bool finish(std::vector<Vector3f> &framebuffer, int spp) const override;
+
+    int maxDepth = 10;          // mirror bounces before the diffuse hit
+    int thetaStrata = 10;       // hemisphere rays per record: thetaStrata * phiStrata
+    int phiStrata = 30;
+    // Record radii are clamped so a record covers between this many pixels
+    // of the image around itself; without it corners spawn records per sample.
+    float minPixelRadius = 3.0f;
+    float maxPixelRadius = 30.0f;
+
+private:
+    // pathLength: distance from the eye, through any mirrors, for the pixel footprint
+    IrradianceCache::Record computeRecord(const Vector3f &p, const Vector3f &n, float pathLength,
+                                          Sampler &sampler) const;
+    Vector3f directLight(const Intersection &isect, const Vector3f &wi, Sampler &sampler) const;
+
+    const Scene &scene;
+    mutable IrradianceCache cache;
+    float pixelAngle; // footprint of one pixel per unit distance
+};
+
+#endif //RAYTRACING_IRRADIANCECACHE_H
@@ -0,0 +1,208 @@
+//
+// Light BVH construction and stochastic traversal.
+//
+
+#include <algorithm>
+#include "LightBVH.hpp"
+#include "Sampler.hpp"
+
+namespace {
+
+inline float safeSqrt(float x) { return std::sqrt(std::max(0.0f, x)); }
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines
+inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+}
+
+inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+// Rodrigues rotation of v by theta around the unit axis k.
+inline Vector3f rotate(const Vector3f &v, const Vector3f &k, float theta)
+{
+    float c = std::cos(theta), s = std::sin(theta);
+    return v * c + crossProduct(k, v) * s + k * (dotProduct(k, v) * (1 - c));
+}
+
+}
+
+float LightBounds::importance(const Vector3f &p, const Vector3f &n) const
+{
+    Vector3f pc = (bounds.pMin + bounds.pMax) * 0.5f;
+    Vector3f d = p - pc;
+    float diag = bounds.Diagonal().norm();
+    float d2 = std::max(dotProduct(d, d), diag / 2);
+    Vector3f wi = normalize(d);
+
+    float cosThetaW = dotProduct(axis, wi);
+    float sinThetaW = safeSqrt(1 - cosThetaW * cosThetaW);
+    // half angle of the bounding sphere seen from p
+    float r2 = diag * diag / 4;
+    float dist2 = dotProduct(d, d);
+    float cosThetaB = dist2 < r2 ? -1.0f : safeSqrt(1 - r2 / dist2);
+    float sinThetaB = safeSqrt(1 - cosThetaB * cosThetaB);
+    float sinThetaO = safeSqrt(1 - cosThetaO * cosThetaO);
+
+    // smallest angle between p and any normal in the cone, from any point in the bounds
+    float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= cosThetaE)
+        return 0.0f;
+
+    float result = phi * cosThetaP / d2;
+    float cosThetaI = std::fabs(dotProduct(wi, n));
+    float sinThetaI = safeSqrt(1 - cosThetaI * cosThetaI);
+    result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    return std::max(0.0f, result);
+}
+
+LightBounds Union(const LightBounds &a, const LightBounds &b)
+{
+    if (a.phi == 0)
+        return b;
+    if (b.phi == 0)
+        return a;
+    LightBounds u;
+    u.bounds = Union(a.bounds, b.bounds);
+    u.phi = a.phi + b.phi;
+    u.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+
+    // smallest cone containing both normal cones
+    float thetaA = std::acos(clamp(-1, 1, a.cosThetaO)), thetaB = std::acos(clamp(-1, 1, b.cosThetaO));
+    float thetaD = std::acos(clamp(-1, 1, dotProduct(a.axis, b.axis)));
+    if (std::min(thetaD + thetaB, (float)M_PI) <= thetaA) {
+        u.axis = a.axis;
+        u.cosThetaO = a.cosThetaO;
+        return u;
+    }
+    if (std::min(thetaD + thetaA, (float)M_PI) <= thetaB) {
+        u.axis = b.axis;
+        u.cosThetaO = b.cosThetaO;
+        return u;
+    }
+    float thetaO = (thetaA + thetaD + thetaB) / 2;
+    Vector3f k = crossProduct(a.axis, b.axis);
+    if (thetaO >= M_PI || dotProduct(k, k) == 0) {
+        u.axis = a.axis;
+        u.cosThetaO = -1;
+        return u;
+    }
+    u.axis = normalize(rotate(a.axis, normalize(k), thetaO - thetaA));
+    u.cosThetaO = std::cos(thetaO);
+    return u;
+}
+
+LightBVH::LightBVH(const std::vector<Object*> &objects)
+{
+    std::vector<Object*> prims;
+    for (auto object : objects)
+        object->getEmitters(prims);
+
+    std::vector<std::pair<int, LightBounds>> leaves;
+    for (auto prim : prims) {
+        Intersection pos;
+        float pdf;
+        prim->Sample(pos, pdf, Vector2f(0.5f, 0.5f));
+        float e = (pos.emit.x + pos.emit.y + pos.emit.z) / 3;
+        if (e <= 0)
+            continue;
+        LightBounds lb;
+        lb.bounds = prim->getBounds();
+        prim->normalCone(lb.axis, lb.cosThetaO);
+        lb.phi = e * prim->getArea() * M_PI;
+        emitterIndex[prim] = emitters.size();
+        emitters.push_back({prim, prim->getArea(), 0});
+        leaves.push_back({(int)emitters.size() - 1, lb});
+    }
+    if (!leaves.empty())
+        build(leaves, 0, leaves.size(), 0, 0);
+}
+
+uint32_t LightBVH::build(std::vector<std::pair<int, LightBounds>> &leaves, size_t begin, size_t end,
+                         uint64_t bitTrail, int depth)
+{
+    uint32_t idx = nodes.size();
+    nodes.emplace_back();
+    if (end - begin == 1) {
+        nodes[idx].lb = leaves[begin].second;
+        nodes[idx].emitter = leaves[begin].first;
+        emitters[leaves[begin].first].bitTrail = bitTrail;
+        return idx;
+    }
+
+    // split at the median centroid along the widest axis
+    Bounds3 centroids;
+    for (size_t i = begin; i < end; ++i)
+        centroids = Union(centroids, leaves[i].second.bounds.Centroid());
+    int axis = centroids.maxExtent();
+    size_t mid = (begin + end) / 2;
+    std::nth_element(leaves.begin() + begin, leaves.begin() + mid, leaves.begin() + end,
+                     [axis](const auto &a, const auto &b) {
+                         Bounds3 ba = a.second.bounds, bb = b.second.bounds;
+                         return ba.Centroid()[axis] < bb.Centroid()[axis];
+                     });
+
+    // median splits keep the depth near log2(n), far below the 64 bits of the trail
+    int bit = std::min(depth, 63);
+    build(leaves, begin, mid, bitTrail, depth + 1);
+    uint32_t second = build(leaves, mid, end, bitTrail | (1ull << bit), depth + 1);
+    nodes[idx].second = second;
+    nodes[idx].lb = Union(nodes[idx + 1].lb, nodes[second].lb);
+    return idx;
+}
+
+bool LightBVH::sample(const Vector3f &p, const Vector3f &n, Intersection &pos, float &pdf, const Vector2f &u) const
+{
+    pdf = 0.0f;
+    if (nodes.empty() || nodes[0].lb.importance(p, n) <= 0)
+        return false;
+    float ux = u.x, prob = 1.0f;
+    uint32_t idx = 0;
+    while (nodes[idx].emitter < 0) {
+        uint32_t left = idx + 1, right = nodes[idx].second;
+        float il = nodes[left].lb.importance(p, n), ir = nodes[right].lb.importance(p, n);
+        if (il <= 0 && ir <= 0)
+            return false;
+        float pl = il / (il + ir);
+        if (ux < pl) {
+            ux = std::min(ux / pl, OneMinusEpsilon);
+            prob *= pl;
+            idx = left;
+        } else {
+            ux = std::min((ux - pl) / (1 - pl), OneMinusEpsilon);
+            prob *= 1 - pl;
+            idx = right;
+        }
+    }
+    const Emitter &e = emitters[nodes[idx].emitter];
+    float areaPdf;
+    e.object->Sample(pos, areaPdf, Vector2f(ux, u.y));
+    pdf = prob * areaPdf;
+    return pdf > 0;
+}
+
+float LightBVH::pdf(const Vector3f &p, const Vector3f &n, const Intersection &lightHit) const
+{
+    auto it = emitterIndex.find(lightHit.obj);
+    if (it == emitterIndex.end() || nodes[0].lb.importance(p, n) <= 0)
+        return 0.0f;
+    const Emitter &e = emitters[it->second];
+    // replay the choices that lead to this emitter
+    float prob = 1.0f;
+    uint32_t idx = 0;
+    for (int depth = 0; nodes[idx].emitter < 0; ++depth) {
+        uint32_t left = idx + 1, right = nodes[idx].second;
+        float il = nodes[left].lb.importance(p, n), ir = nodes[right].lb.importance(p, n);
+        if (il + ir <= 0)
+            return 0.0f;
+        bool goRight = e.bitTrail >> std::min(depth, 63) & 1;
+        prob *= (goRight ? ir : il) / (il + ir);
+        idx = goRight ? right : left;
+    }
+    return prob / e.area;
+}
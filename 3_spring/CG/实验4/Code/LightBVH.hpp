@@ -0,0 +1,65 @@
+//
+// Light BVH for many-light sampling (Conty & Kulla 2018, as in pbrt-v4).
+// Every node bounds its emitters' positions, their normals (a cone) and
+// their total power; sampling walks from the root, choosing each child in
+// proportion to an estimate of how much it can light the shading point.
+//
+
+#ifndef RAYTRACING_LIGHTBVH_H
+#define RAYTRACING_LIGHTBVH_H
+
+#include <unordered_map>
+#include <vector>
+#include "Object.hpp"
+
+struct LightBounds
+{
+    Bounds3 bounds;
+    Vector3f axis;            // normal cone
+    float cosThetaO = 1.0f;   // spread of the normals
+    float cosThetaE = 0.0f;   // emission falloff around each normal (pi/2: area lights)
+    float phi = 0.0f;         // power
+
+    // Conservative estimate of the light reaching p on a surface with normal n.
+    float importance(const Vector3f &p, const Vector3f &n) const;
+};
+
+LightBounds Union(const LightBounds &a, const LightBounds &b);
+
+class LightBVH
+{
+public:
+    explicit LightBVH(const std::vector<Object*> &objects);
+
+    // Picks an emitter for the shading point (p, n) and a point on it; pdf is
+    // w.r.t. area on the light. Returns false if no light can reach p.
+    bool sample(const Vector3f &p, const Vector3f &n, Intersection &pos, float &pdf, const Vector2f &u) const;
+    // Area pdf of sample() producing the point `lightHit` on emitter lightHit.obj.
+    float pdf(const Vector3f &p, const Vector3f &n, const Intersection &lightHit) const;
+
+    size_t size() const { return emitters.size(); }
+
+private:
+    struct Node
+    {
+        LightBounds lb;
+        uint32_t second = 0;  // right child; the left one follows this node
+        int emitter = -1;     // leaf: index into emitters
+    };
+
+    struct Emitter
+    {
+        Object *object;
+        float area;
+        uint64_t bitTrail;    // left/right choices from the root, lowest bit first
+    };
+
+    uint32_t build(std::vector<std::pair<int, LightBounds>> &leaves, size_t begin, size_t end,
+                   uint64_t bitTrail, int depth);
+
+    std::vector<Node> nodes;
+    std::vector<Emitter> emitters;
+    std::unordered_map<const Object*, int> emitterIndex;
+};
+
+#endif //RAYTRACING_LIGHTBVH_H
@@ -7,7 +7,43 @@
 
 #include "Vector.hpp"
 
-enum MaterialType { DIFFUSE, MIRROR };
+// GLOSSY is a normalized Phong lobe around the mirror direction with
+// exponent specularExponent and albedo Ks; large exponents make it near-delta.
+enum MaterialType { DIFFUSE, MIRROR, GLOSSY };
+
+// Orthonormal shading frame around the normal N. Built once per hit and
+// reused for every BSDF query at that hit.
+struct Frame {
+    Vector3f s, t, n;
+
+    Frame() {}
+    explicit Frame(const Vector3f &N) : n(N) {
+        if (std::fabs(N.x) > std::fabs(N.y)){
+            float invLen = 1.0f / std::sqrt(N.x * N.x + N.z * N.z);
+            t = Vector3f(N.z * invLen, 0.0f, -N.x *invLen);
+        }
+        else {
+            float invLen = 1.0f / std::sqrt(N.y * N.y + N.z * N.z);
+            t = Vector3f(0.0f, N.z * invLen, -N.y *invLen);
+        }
+        s = crossProduct(t, N);
+    }
+
+    Vector3f toWorld(const Vector3f &a) const { return a.x * s + a.y * t + a.z * n; }
+    Vector3f toLocal(const Vector3f &v) const {
+        return Vector3f(dotProduct(v, s), dotProduct(v, t), dotProduct(v, n));
+    }
+    float cosTheta(const Vector3f &w) const { return dotProduct(w, n); }
+};
+
+// Result of sampling a BSDF: direction, its pdf and the path throughput
+// factor eval * cos / pdf, all from one call.
+struct BSDFSample {
+    Vector3f wo;
+    float pdf = 0.0f;
+    Vector3f weight;
+    bool isDelta = false;
+};
 
 class Material{
 private:
@@ -71,20 +107,6 @@ private:
         // kt = 1 - kr;
     }
 
-    Vector3f toWorld(const Vector3f &a, const Vector3f &N){
-        Vector3f B, C;
-        if (std::fabs(N.x) > std::fabs(N.y)){
-            float invLen = 1.0f / std::sqrt(N.x * N.x + N.z * N.z);
-            C = Vector3f(N.z * invLen, 0.0f, -N.x *invLen);
-        }
-        else {
-            float invLen = 1.0f / std::sqrt(N.y * N.y + N.z * N.z);
-            C = Vector3f(0.0f, N.z * invLen, -N.y *invLen);
-        }
-        B = crossProduct(C, N);
-        return a.x * B + a.y * C + a.z * N;
-    }
-
 public:
     MaterialType m_type;
     //Vector3f m_color;
@@ -101,12 +123,15 @@ public:
     inline Vector3f getEmission();
     inline bool hasEmission();
 
-    // sample a ray by Material properties
-    inline Vector3f sample(const Vector3f &wi, const Vector3f &N);
-    // given a ray, calculate the PdF of this ray
-    inline float pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N);
-    // given a ray, calculate the contribution of this ray
-    inline Vector3f eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N);
+    // Fused sampling: one call returns direction, pdf and weight. The
+    // templated forms are used by the integrator after it has switched on
+    // m_type once per hit; sample(wi, frame) does that switch itself.
+    template <MaterialType T> inline BSDFSample sampleBSDF(const Vector3f &wi, const Frame &frame, const Vector2f &u) const;
+    template <MaterialType T> inline Vector3f evalBSDF(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const;
+    template <MaterialType T> inline float pdfBSDF(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const;
+    inline BSDFSample sample(const Vector3f &wi, const Frame &frame, const Vector2f &u) const;
+    inline Vector3f eval(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const;
+    inline float pdf(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const;
 
 };
 
@@ -114,6 +139,8 @@ Material::Material(MaterialType t, Vector3f e){
     m_type = t;
     //m_color = c;
     m_emission = e;
+    ior = 1.0f;
+    specularExponent = 0.0f;
 }
 
 MaterialType Material::getType(){return m_type;}
@@ -129,77 +156,139 @@ Vector3f Material::getColorAt(double u, double v) {
 }
 
 
-Vector3f Material::sample(const Vector3f &wi, const Vector3f &N){
+template <>
+inline BSDFSample Material::sampleBSDF<DIFFUSE>(const Vector3f &wi, const Frame &frame, const Vector2f &u) const
+{
+    // cosine-weighted sample on the hemisphere (Malley's method)
+    BSDFSample bs;
+    float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+    float z = std::sqrt(std::max(0.0f, 1.0f - u.x));
+    bs.wo = frame.toWorld(Vector3f(r*std::cos(phi), r*std::sin(phi), z));
+    if (z > 0.0f) {
+        bs.pdf = z / M_PI;
+        // Kd / pi * cos / (cos / pi)
+        bs.weight = Kd;
+    }
+    return bs;
+}
+
+template <>
+inline Vector3f Material::evalBSDF<DIFFUSE>(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
+    if (frame.cosTheta(wo) > 0.0f)
+        return Kd / M_PI;
+    return Vector3f(0.0f);
+}
+
+template <>
+inline float Material::pdfBSDF<DIFFUSE>(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
+    float cosalpha = frame.cosTheta(wo);
+    return cosalpha > 0.0f ? cosalpha / M_PI : 0.0f;
+}
+
+template <>
+inline BSDFSample Material::sampleBSDF<MIRROR>(const Vector3f &wi, const Frame &frame, const Vector2f &u) const
+{
+    BSDFSample bs;
+    bs.isDelta = true;
+    bs.wo = reflect(wi, frame.n);
+    float cosalpha = frame.cosTheta(bs.wo);
+    if (cosalpha > EPSILON) {
+        float kr;
+        fresnel(wi, frame.n, ior, kr);
+        // eval is kr / cos for the delta lobe, so the weight is just kr
+        bs.pdf = 1.0f;
+        bs.weight = Vector3f(kr);
+    }
+    return bs;
+}
+
+template <>
+inline Vector3f Material::evalBSDF<MIRROR>(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
+    // A delta lobe has no value for an arbitrary pair of directions.
+    return Vector3f(0.0f);
+}
+
+template <>
+inline float Material::pdfBSDF<MIRROR>(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
+    return 0.0f;
+}
+
+template <>
+inline BSDFSample Material::sampleBSDF<GLOSSY>(const Vector3f &wi, const Frame &frame, const Vector2f &u) const
+{
+    // sample cos^n around the mirror direction, pdf (n+1)/(2pi) cos^n
+    BSDFSample bs;
+    float n = specularExponent;
+    float cosalpha = std::pow(u.x, 1.0f / (n + 1.0f));
+    float sinalpha = std::sqrt(std::max(0.0f, 1.0f - cosalpha * cosalpha));
+    float phi = 2 * M_PI * u.y;
+    Frame lobe(reflect(wi, frame.n));
+    bs.wo = lobe.toWorld(Vector3f(sinalpha * std::cos(phi), sinalpha * std::sin(phi), cosalpha));
+    float cosTheta = frame.cosTheta(bs.wo);
+    if (cosTheta > 0.0f) {
+        bs.pdf = (n + 1.0f) / (2 * M_PI) * std::pow(cosalpha, n);
+        // Ks (n+2)/(2pi) cos^n * cos / pdf
+        bs.weight = Ks * ((n + 2.0f) / (n + 1.0f) * cosTheta);
+    }
+    return bs;
+}
+
+template <>
+inline Vector3f Material::evalBSDF<GLOSSY>(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
+    if (frame.cosTheta(wo) <= 0.0f)
+        return Vector3f(0.0f);
+    float cosalpha = dotProduct(wo, reflect(wi, frame.n));
+    if (cosalpha <= 0.0f)
+        return Vector3f(0.0f);
+    float n = specularExponent;
+    return Ks * ((n + 2.0f) / (2 * M_PI) * std::pow(cosalpha, n));
+}
+
+template <>
+inline float Material::pdfBSDF<GLOSSY>(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
+    if (frame.cosTheta(wo) <= 0.0f)
+        return 0.0f;
+    float cosalpha = dotProduct(wo, reflect(wi, frame.n));
+    if (cosalpha <= 0.0f)
+        return 0.0f;
+    float n = specularExponent;
+    return (n + 1.0f) / (2 * M_PI) * std::pow(cosalpha, n);
+}
+
+BSDFSample Material::sample(const Vector3f &wi, const Frame &frame, const Vector2f &u) const
+{
     switch(m_type){
-        case DIFFUSE:
-        {
-            // uniform sample on the hemisphere
-            float x_1 = get_random_float(), x_2 = get_random_float();
-            float z = std::fabs(1.0f - 2.0f * x_1);
-            float r = std::sqrt(1.0f - z * z), phi = 2 * M_PI * x_2;
-            Vector3f localRay(r*std::cos(phi), r*std::sin(phi), z);
-            return toWorld(localRay, N);
-            break;
-        }
-        case MIRROR:
-        {
-            Vector3f localRay = reflect(wi, N);
-            return localRay;
-            break;
-        }
+        case DIFFUSE: return sampleBSDF<DIFFUSE>(wi, frame, u);
+        case MIRROR: return sampleBSDF<MIRROR>(wi, frame, u);
+        case GLOSSY: return sampleBSDF<GLOSSY>(wi, frame, u);
     }
+    return BSDFSample();
 }
 
-float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
+Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
     switch(m_type){
-        case DIFFUSE:
-        {
-            // uniform sample probability 1 / (2 * PI)
-            if (dotProduct(wo, N) > 0.0f)
-                return 0.5f / M_PI;
-            else
-                return 0.0f;
-            break;
-        }
-        case MIRROR:
-        {
-            if (dotProduct(wo, N) > EPSILON)
-                return 1.0f;
-            else
-                return 0.0f;
-            break;
-        }
+        case DIFFUSE: return evalBSDF<DIFFUSE>(wi, wo, frame);
+        case MIRROR: return evalBSDF<MIRROR>(wi, wo, frame);
+        case GLOSSY: return evalBSDF<GLOSSY>(wi, wo, frame);
     }
+    return Vector3f(0.0f);
 }
 
-Vector3f Material::eval(const Vector3f &wi, const Vector3f &wo, const Vector3f &N){
+float Material::pdf(const Vector3f &wi, const Vector3f &wo, const Frame &frame) const
+{
     switch(m_type){
-        case DIFFUSE:
-        {
-            // calculate the contribution of diffuse   model
-            float cosalpha = dotProduct(N, wo);
-            if (cosalpha > 0.0f) {
-                Vector3f diffuse = Kd / M_PI;
-                return diffuse;
-            }
-            else
-                return Vector3f(0.0f);
-            break;
-        }
-        case MIRROR:
-        {
-            float cosalpha = dotProduct(N, wo);
-            float kr;
-            if (cosalpha > EPSILON) {
-                fresnel(wi, N, ior, kr);
-                Vector3f mirror = 1 / cosalpha;
-                return kr * mirror;        
-            }
-            else
-                return Vector3f(0.0f);
-            break;
-        }
+        case DIFFUSE: return pdfBSDF<DIFFUSE>(wi, wo, frame);
+        case MIRROR: return pdfBSDF<MIRROR>(wi, wo, frame);
+        case GLOSSY: return pdfBSDF<GLOSSY>(wi, wo, frame);
     }
+    return 0.0f;
 }
 
 #endif //RAYTRACING_MATERIAL_H
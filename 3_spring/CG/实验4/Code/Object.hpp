@@ -10,6 +10,7 @@
 #include "Bounds3.hpp"
 #include "Ray.hpp"
 #include "Intersection.hpp"
+#include <vector>
 
 class Object
 {
@@ -23,8 +24,24 @@ public:
     virtual Vector3f evalDiffuseColor(const Vector2f &) const =0;
     virtual Bounds3 getBounds()=0;
     virtual float getArea()=0;
-    virtual void Sample(Intersection &pos, float &pdf)=0;
+    // Uniformly sample a point on the surface (pdf w.r.t. area) from u in [0,1)^2.
+    virtual void Sample(Intersection &pos, float &pdf, const Vector2f &u)=0;
     virtual bool hasEmit()=0;
+    // Emitting primitives for the light BVH; meshes hand out their triangles.
+    virtual void getEmitters(std::vector<Object*> &emitters) { if (hasEmit()) emitters.push_back(this); }
+    // Bounds of the part of the surface inside box, empty if there is none;
+    // used by spatial BVH splits. By default the bounding box is clipped.
+    virtual Bounds3 clipBounds(const Bounds3 &box)
+    {
+        Bounds3 b = getBounds(), clipped;
+        clipped.pMin = Vector3f::Max(b.pMin, box.pMin);
+        clipped.pMax = Vector3f::Min(b.pMax, box.pMax);
+        if (clipped.pMin.x > clipped.pMax.x || clipped.pMin.y > clipped.pMax.y || clipped.pMin.z > clipped.pMax.z)
+            return Bounds3();
+        return clipped;
+    }
+    // Cone (axis, cos of the half angle) around all surface normals.
+    virtual void normalCone(Vector3f &axis, float &cosTheta) { axis = Vector3f(0, 0, 1); cosTheta = -1; }
 };
 
 
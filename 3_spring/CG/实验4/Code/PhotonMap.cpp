@@ -0,0 +1,50 @@
+//
+// Balanced kd-tree over photons, built in place with OpenMP tasks.
+//
+
+#include <algorithm>
+#include "PhotonMap.hpp"
+#include "Bounds3.hpp"
+
+namespace {
+// below this many photons a subtree is built by the current task
+const int kSerialBuildSize = 1 << 14;
+}
+
+void PhotonMap::build(std::vector<Photon> &&p)
+{
+    photons = std::move(p);
+    #pragma omp parallel
+    #pragma omp single nowait
+    build(0, (int)photons.size(), 0);
+}
+
+void PhotonMap::build(int lo, int hi, int depth)
+{
+    if (hi - lo <= 0)
+        return;
+    int mid = (lo + hi) / 2;
+    if (hi - lo == 1) {
+        photons[mid].axis = -1;
+        return;
+    }
+
+    Bounds3 bounds;
+    for (int i = lo; i < hi; ++i)
+        bounds = Union(bounds, photons[i].p);
+    int axis = bounds.maxExtent();
+    std::nth_element(photons.begin() + lo, photons.begin() + mid, photons.begin() + hi,
+                     [axis](const Photon &a, const Photon &b) { return a.p[axis] < b.p[axis]; });
+    photons[mid].axis = axis;
+
+    if (hi - lo > kSerialBuildSize) {
+        #pragma omp task
+        build(lo, mid, depth + 1);
+        build(mid + 1, hi, depth + 1);
+        #pragma omp taskwait
+    }
+    else {
+        build(lo, mid, depth + 1);
+        build(mid + 1, hi, depth + 1);
+    }
+}
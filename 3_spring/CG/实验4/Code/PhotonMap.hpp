@@ -0,0 +1,69 @@
+//
+// Balanced kd-tree over photons, built in place with OpenMP tasks.
+//
+
+#ifndef RAYTRACING_PHOTONMAP_H
+#define RAYTRACING_PHOTONMAP_H
+
+#include <vector>
+#include "Vector.hpp"
+
+struct Photon
+{
+    Vector3f p;
+    Vector3f wi;    // direction the photon was travelling
+    Vector3f beta;  // carried flux
+    int axis = -1;  // split axis of the kd-tree node, -1 for leaves
+};
+
+class PhotonMap
+{
+public:
+    // Takes the photons and reorders them into an implicit balanced kd-tree:
+    // the node of range [lo, hi) is stored at (lo + hi) / 2.
+    void build(std::vector<Photon> &&photons);
+
+    // Calls fn(photon) for every photon within radius of p.
+    template <typename F>
+    void lookup(const Vector3f &p, float radius, F &&fn) const
+    {
+        if (!photons.empty())
+            lookup(0, (int)photons.size(), p, radius * radius, fn);
+    }
+
+    size_t size() const { return photons.size(); }
+
+private:
+    void build(int lo, int hi, int depth);
+
+    template <typename F>
+    void lookup(int lo, int hi, const Vector3f &p, float radius2, F &fn) const
+    {
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            const Photon &ph = photons[mid];
+            Vector3f d = ph.p - p;
+            if (dotProduct(d, d) <= radius2)
+                fn(ph);
+            if (ph.axis < 0)
+                return;
+            float delta = p[ph.axis] - ph.p[ph.axis];
+            // visit the near side by iteration, the far side only if the
+            // sphere crosses the splitting plane
+            if (delta <= 0) {
+                if (delta * delta <= radius2)
+                    lookup(mid + 1, hi, p, radius2, fn);
+                hi = mid;
+            }
+            else {
+                if (delta * delta <= radius2)
+                    lookup(lo, mid, p, radius2, fn);
+                lo = mid + 1;
+            }
+        }
+    }
+
+    std::vector<Photon> photons;
+};
+
+#endif //RAYTRACING_PHOTONMAP_H
@@ -0,0 +1,110 @@
+//
+// Per-thread ring buffers and Chrome trace JSON output.
+//
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Profiler.hpp"
+
+namespace profiler {
+
+namespace {
+
+struct Event {
+    const char *name;
+    uint64_t beginNs, endNs;
+    int64_t arg;
+};
+
+struct ThreadBuffer {
+    static constexpr size_t kCapacity = 1 << 16;
+    std::unique_ptr<Event[]> ring{new Event[kCapacity]};
+    std::atomic<size_t> count{0};
+    int tid = 0;
+    std::string name;
+};
+
+// Buffers are owned here, not by their threads, so zones recorded by
+// threads that have already exited still make it into the trace.
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+const uint64_t startNs = nowNs();
+
+ThreadBuffer &local()
+{
+    thread_local ThreadBuffer *buffer = [] {
+        std::lock_guard<std::mutex> guard(registryMutex);
+        buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffers.back()->tid = (int)buffers.size();
+        return buffers.back().get();
+    }();
+    return *buffer;
+}
+
+void escape(FILE *fp, const std::string &s)
+{
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            fputc('\\', fp);
+        fputc(c, fp);
+    }
+}
+
+}
+
+void record(const char *name, uint64_t beginNs, uint64_t endNs, int64_t arg)
+{
+    ThreadBuffer &buffer = local();
+    size_t n = buffer.count.load(std::memory_order_relaxed);
+    buffer.ring[n % ThreadBuffer::kCapacity] = Event{name, beginNs, endNs, arg};
+    buffer.count.store(n + 1, std::memory_order_release);
+}
+
+void nameThread(const char *name)
+{
+    if (enabled.load(std::memory_order_relaxed))
+        local().name = name;
+}
+
+bool writeChromeTrace(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        return false;
+    std::lock_guard<std::mutex> guard(registryMutex);
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    size_t dropped = 0;
+    for (auto &buffer : buffers) {
+        if (!buffer->name.empty()) {
+            fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"",
+                    first ? "" : ",\n", buffer->tid);
+            escape(fp, buffer->name);
+            fprintf(fp, "\"}}");
+            first = false;
+        }
+        size_t n = buffer->count.load(std::memory_order_acquire);
+        size_t begin = n > ThreadBuffer::kCapacity ? n - ThreadBuffer::kCapacity : 0;
+        dropped += begin;
+        for (size_t i = begin; i < n; ++i) {
+            const Event &e = buffer->ring[i % ThreadBuffer::kCapacity];
+            // timestamps in microseconds since the profiler started
+            fprintf(fp, "%s{\"name\": \"", first ? "" : ",\n");
+            escape(fp, e.name);
+            fprintf(fp, "\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f", buffer->tid,
+                    (e.beginNs - startNs) * 1e-3, (e.endNs - e.beginNs) * 1e-3);
+            if (e.arg >= 0)
+                fprintf(fp, ", \"args\": {\"index\": %lld}", (long long)e.arg);
+            fprintf(fp, "}");
+            first = false;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (dropped)
+        fprintf(stderr, "profiler: %zu oldest zones were overwritten\n", dropped);
+    return fclose(fp) == 0;
+}
+
+}
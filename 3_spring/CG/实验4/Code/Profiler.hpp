@@ -0,0 +1,56 @@
+//
+// Scoped-zone profiler with Chrome trace export (chrome://tracing, Perfetto).
+// Every thread records finished zones into its own ring buffer, so zones
+// never contend; when the buffer wraps the oldest zones are dropped.
+// Recording is off until profiler::enabled is set.
+//
+
+#ifndef RAYTRACING_PROFILER_H
+#define RAYTRACING_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace profiler {
+
+inline std::atomic<bool> enabled{false};
+
+inline uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// name must be a string literal (or otherwise outlive the export).
+void record(const char *name, uint64_t beginNs, uint64_t endNs, int64_t arg);
+// Label for the calling thread in the trace viewer.
+void nameThread(const char *name);
+bool writeChromeTrace(const std::string &path);
+
+class Zone
+{
+public:
+    explicit Zone(const char *name, int64_t arg = -1)
+        : name(enabled.load(std::memory_order_relaxed) ? name : nullptr), arg(arg), begin(this->name ? nowNs() : 0) {}
+    ~Zone()
+    {
+        if (name)
+            record(name, begin, nowNs(), arg);
+    }
+
+private:
+    const char *name;
+    int64_t arg;
+    uint64_t begin;
+};
+
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+// PROFILE_ZONE("name") or PROFILE_ZONE("name", index) times the enclosing scope.
+#define PROFILE_ZONE(...) profiler::Zone PROFILE_CONCAT(profileZone, __LINE__)(__VA_ARGS__)
+
+#endif //RAYTRACING_PROFILER_H
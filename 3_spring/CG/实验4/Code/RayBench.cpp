@@ -0,0 +1,322 @@
+//
+// Ray throughput benchmark: builds the Cornell box, the bunny scene used by
+// main.cpp and a procedurally displaced sphere of about a million triangles,
+// then measures BVH build time and Mrays/s for primary, shadow and
+// incoherent (diffuse bounce) rays plus Scene::castRay samples/s at several
+// thread counts. Results are written as JSON.
+//
+// ./RayBench [--scenes cornell,bunny,procedural] [--triangles N] [--res N]
+//            [--reps N] [--threads N] [--split naive|sbvh]
+//            [--layout pointer|treelet|quantized] [--out benchmark.json]
+//
+
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include "Scene.hpp"
+#include "Triangle.hpp"
+#include "Camera.hpp"
+#include "Sampler.hpp"
+#include "Simd.hpp"
+
+// same value as the renderer (Renderer.cpp)
+const float EPSILON = 0.00016;
+
+namespace {
+
+// Keeps results alive without the optimizer folding the loops away.
+volatile long sink;
+
+struct BenchScene {
+    explicit BenchScene(const std::string &name, int res) : name(name), scene(res, res) {}
+
+    std::string name;
+    Scene scene;
+    std::vector<std::unique_ptr<MeshTriangle>> meshes;
+    size_t triangles = 0;
+    double loadSeconds = 0, bvhSeconds = 0;
+    size_t bvhBytes = 0;
+};
+
+struct RaySet {
+    std::vector<Ray> primary, incoherent;
+    std::vector<std::pair<Vector3f, Vector3f>> shadow;
+};
+
+struct ScalingPoint {
+    int threads;
+    double primary, shadow, incoherent, paths;
+};
+
+// Sphere around `center` with a bumpy radius, outward facing, ~`count` triangles.
+std::vector<Vector3f> displacedSphere(const Vector3f &center, float radius, size_t count)
+{
+    int rings = std::max(4, (int)std::sqrt(count / 4.0));
+    int segs = 2 * rings;
+    auto point = [&](int i, int j) {
+        float theta = M_PI * i / rings, phi = 2 * M_PI * j / segs;
+        float r = radius * (1 + 0.05f * std::sin(12 * theta) * std::sin(9 * phi));
+        return center + r * Vector3f(std::sin(theta) * std::cos(phi), std::cos(theta),
+                                     std::sin(theta) * std::sin(phi));
+    };
+    std::vector<Vector3f> verts;
+    verts.reserve((size_t)rings * segs * 6);
+    auto face = [&](const Vector3f &a, Vector3f b, Vector3f c) {
+        Vector3f n = crossProduct(b - a, c - a);
+        if (n.norm2() == 0)
+            return; // collapsed triangles at the poles
+        if (dotProduct(n, a - center) < 0)
+            std::swap(b, c);
+        verts.push_back(a), verts.push_back(b), verts.push_back(c);
+    };
+    for (int i = 0; i < rings; ++i)
+        for (int j = 0; j < segs; ++j) {
+            Vector3f p00 = point(i, j), p10 = point(i + 1, j);
+            Vector3f p11 = point(i + 1, j + 1), p01 = point(i, j + 1);
+            face(p00, p10, p11);
+            face(p00, p11, p01);
+        }
+    return verts;
+}
+
+std::unique_ptr<BenchScene> makeScene(const std::string &name, int res, size_t proceduralTriangles)
+{
+    auto bench = std::make_unique<BenchScene>(name, res);
+    Material* red = new Material(DIFFUSE, Vector3f(0.0f));
+    red->Kd = Vector3f(0.63f, 0.065f, 0.05f);
+    Material* green = new Material(DIFFUSE, Vector3f(0.0f));
+    green->Kd = Vector3f(0.14f, 0.45f, 0.091f);
+    Material* white = new Material(DIFFUSE, Vector3f(0.0f));
+    white->Kd = Vector3f(0.725f, 0.71f, 0.68f);
+    Material* mirror = new Material(MIRROR, Vector3f(0.0f));
+    mirror->ior = 40.0f;
+    Material* light = new Material(DIFFUSE, Vector3f(47.8f, 38.6f, 31.1f));
+    light->Kd = Vector3f(0.65f);
+
+    double start = omp_get_wtime();
+    auto add = [&](MeshTriangle *mesh) {
+        bench->meshes.emplace_back(mesh);
+        bench->scene.Add(mesh);
+        bench->triangles += mesh->triangles.size();
+    };
+    add(new MeshTriangle("../models/cornellbox/floor.obj", white));
+    add(new MeshTriangle("../models/cornellbox/left.obj", red));
+    add(new MeshTriangle("../models/cornellbox/right.obj", green));
+    add(new MeshTriangle("../models/cornellbox/light.obj", light));
+    if (name == "cornell") {
+        add(new MeshTriangle("../models/cornellbox/shortbox.obj", white));
+        add(new MeshTriangle("../models/cornellbox/tallbox.obj", white));
+    }
+    else if (name == "bunny") {
+        add(new MeshTriangle("../models/cornellbox/tallbox.obj", mirror));
+        add(new MeshTriangle("../models/bunny/bunny.obj", mirror, Vector3f(200,-60,150),
+            Vector3f(1500,1500,1500), Vector3f(-1,0,0), Vector3f(0,1,0), Vector3f(0,0,-1)));
+    }
+    else if (name == "procedural") {
+        add(new MeshTriangle(displacedSphere(Vector3f(278, 200, 280), 150, proceduralTriangles), white));
+    }
+    else {
+        return nullptr;
+    }
+    bench->scene.buildBVH();
+    bench->loadSeconds = omp_get_wtime() - start;
+
+    // time the BVH builds on their own, without the file parsing
+    for (auto &mesh : bench->meshes) {
+        std::vector<Object*> ptrs;
+        for (auto &tri : mesh->triangles)
+            ptrs.push_back(&tri);
+        start = omp_get_wtime();
+        BVHAccel *bvh = new BVHAccel(ptrs, 1, BVHAccel::defaultSplitMethod);
+        bench->bvhSeconds += omp_get_wtime() - start;
+        delete mesh->bvh;
+        mesh->bvh = bvh;
+    }
+    start = omp_get_wtime();
+    bench->scene.buildBVH();
+    bench->bvhSeconds += omp_get_wtime() - start;
+    bench->bvhBytes = bench->scene.bvh->traversalBytes();
+    for (auto &mesh : bench->meshes)
+        bench->bvhBytes += mesh->bvh->traversalBytes();
+    return bench;
+}
+
+// One jittered camera ray per pixel; every non-emissive hit spawns a shadow
+// segment to a point on the light and a cosine-distributed bounce ray.
+RaySet makeRays(const Scene &scene, const Camera &camera)
+{
+    RaySet rays;
+    IndependentSampler sampler(7);
+    for (int j = 0; j < camera.height; ++j)
+        for (int i = 0; i < camera.width; ++i) {
+            sampler.startPixelSample(i, j, 0);
+            Vector2f jitter = sampler.getPixel2D();
+            Ray ray = camera.generateRay(i + jitter.x, j + jitter.y);
+            rays.primary.push_back(ray);
+            Intersection hit = scene.intersect(ray);
+            if (!hit.happened || hit.m->hasEmission())
+                continue;
+            Intersection lightPos;
+            float pdf;
+            scene.sampleLight(lightPos, pdf, sampler.get2D());
+            rays.shadow.emplace_back(hit.coords, lightPos.coords);
+
+            Vector2f u = sampler.get2D();
+            float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+            Frame frame(hit.normal);
+            Vector3f dir = frame.toWorld(Vector3f(r * std::cos(phi), r * std::sin(phi),
+                                                  std::sqrt(std::max(0.0f, 1.0f - u.x))));
+            rays.incoherent.emplace_back(hit.coords, normalize(dir));
+        }
+    return rays;
+}
+
+// Best of `reps` runs of trace(i) for i in [0, n), in millions per second.
+template <typename F>
+double millionsPerSecond(size_t n, int threads, int reps, F &&trace)
+{
+    double best = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        long hits = 0;
+        double start = omp_get_wtime();
+        #pragma omp parallel for num_threads(threads) schedule(dynamic, 256) reduction(+:hits)
+        for (long i = 0; i < (long)n; ++i)
+            hits += trace(i);
+        best = std::min(best, omp_get_wtime() - start);
+        sink = hits;
+    }
+    return n / best * 1e-6;
+}
+
+double pathSamplesPerSecond(const Scene &scene, const Camera &camera, int threads, int reps)
+{
+    // every 4th pixel in each direction keeps this comparable to the ray passes
+    const int stride = 4, w = camera.width / stride, h = camera.height / stride;
+    double best = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        long hits = 0;
+        double start = omp_get_wtime();
+        #pragma omp parallel num_threads(threads) reduction(+:hits)
+        {
+            IndependentSampler sampler(r);
+            #pragma omp for schedule(dynamic, 16)
+            for (int p = 0; p < w * h; ++p) {
+                int i = p % w * stride, j = p / w * stride;
+                sampler.startPixelSample(i, j, 0);
+                Vector2f jitter = sampler.getPixel2D();
+                Vector3f L = scene.castRay(camera.generateRay(i + jitter.x, j + jitter.y), 0, sampler);
+                hits += L.x > 0;
+            }
+        }
+        best = std::min(best, omp_get_wtime() - start);
+        sink = hits;
+    }
+    return (double)w * h / best * 1e-6;
+}
+
+std::vector<int> threadCounts(int maxThreads)
+{
+    std::vector<int> counts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string scenes = "cornell,bunny,procedural", out = "benchmark.json";
+    size_t proceduralTriangles = 1 << 20;
+    int res = 512, reps = 3, maxThreads = omp_get_max_threads();
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i], value = argv[i + 1];
+        if (arg == "--scenes")
+            scenes = value;
+        else if (arg == "--triangles")
+            proceduralTriangles = std::stoul(value);
+        else if (arg == "--res")
+            res = std::stoi(value);
+        else if (arg == "--reps")
+            reps = std::stoi(value);
+        else if (arg == "--threads")
+            maxThreads = std::stoi(value);
+        else if (arg == "--split")
+            BVHAccel::defaultSplitMethod = value == "sbvh" ? BVHAccel::SplitMethod::SBVH : BVHAccel::SplitMethod::NAIVE;
+        else if (arg == "--layout")
+            BVHAccel::defaultLayout = value == "treelet" ? BVHAccel::NodeLayout::Treelet :
+                                      value == "quantized" ? BVHAccel::NodeLayout::QuantizedTreelet :
+                                      BVHAccel::NodeLayout::Pointer;
+        else if (arg == "--out")
+            out = value;
+        else
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+    }
+
+    FILE *json = fopen(out.c_str(), "w");
+    if (!json) {
+        perror(out.c_str());
+        return 1;
+    }
+    fprintf(json, "{\n  \"isa\": \"%s\",\n  \"max_threads\": %d,\n  \"resolution\": %d,\n  \"reps\": %d,\n"
+                  "  \"split\": \"%s\",\n  \"layout\": \"%s\",\n  \"scenes\": [",
+            simd::isaName(simd::activeISA()), maxThreads, res, reps,
+            BVHAccel::defaultSplitMethod == BVHAccel::SplitMethod::SBVH ? "sbvh" : "naive",
+            BVHAccel::defaultLayout == BVHAccel::NodeLayout::Treelet ? "treelet" :
+            BVHAccel::defaultLayout == BVHAccel::NodeLayout::QuantizedTreelet ? "quantized" : "pointer");
+
+    std::stringstream names(scenes);
+    std::string name;
+    bool first = true;
+    while (std::getline(names, name, ',')) {
+        std::unique_ptr<BenchScene> bench = makeScene(name, res, proceduralTriangles);
+        if (!bench) {
+            fprintf(stderr, "unknown scene %s\n", name.c_str());
+            continue;
+        }
+        const Scene &scene = bench->scene;
+        Camera camera(Vector3f(278, 273, -800), scene.fov, res, res);
+        RaySet rays = makeRays(scene, camera);
+
+        std::vector<ScalingPoint> scaling;
+        for (int threads : threadCounts(maxThreads)) {
+            ScalingPoint point;
+            point.threads = threads;
+            point.primary = millionsPerSecond(rays.primary.size(), threads, reps,
+                [&](long i) { return scene.intersect(rays.primary[i]).happened; });
+            point.shadow = millionsPerSecond(rays.shadow.size(), threads, reps,
+                [&](long i) { return scene.visible(rays.shadow[i].first, rays.shadow[i].second); });
+            point.incoherent = millionsPerSecond(rays.incoherent.size(), threads, reps,
+                [&](long i) { return scene.intersect(rays.incoherent[i]).happened; });
+            point.paths = pathSamplesPerSecond(scene, camera, threads, reps);
+            scaling.push_back(point);
+            printf("%-10s %2d threads: primary %7.3f  shadow %7.3f  incoherent %7.3f Mrays/s, "
+                   "castRay %7.4f Msamples/s\n", name.c_str(), threads, point.primary, point.shadow,
+                   point.incoherent, point.paths);
+        }
+
+        fprintf(json, "%s\n    {\n      \"name\": \"%s\",\n      \"triangles\": %zu,\n"
+                      "      \"load_seconds\": %.4f,\n      \"bvh_build_seconds\": %.4f,\n      \"bvh_bytes\": %zu,\n"
+                      "      \"rays\": {\"primary\": %zu, \"shadow\": %zu, \"incoherent\": %zu},\n"
+                      "      \"scaling\": [",
+                first ? "" : ",", name.c_str(), bench->triangles, bench->loadSeconds, bench->bvhSeconds,
+                bench->bvhBytes, rays.primary.size(), rays.shadow.size(), rays.incoherent.size());
+        for (size_t k = 0; k < scaling.size(); ++k) {
+            const ScalingPoint &p = scaling[k];
+            fprintf(json, "%s\n        {\"threads\": %d, \"primary_mrays\": %.4f, \"shadow_mrays\": %.4f, "
+                          "\"incoherent_mrays\": %.4f, \"castray_msamples\": %.5f, \"primary_speedup\": %.3f}",
+                    k ? "," : "", p.threads, p.primary, p.shadow, p.incoherent, p.paths,
+                    p.primary / scaling[0].primary);
+        }
+        fprintf(json, "\n      ]\n    }");
+        first = false;
+    }
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+    printf("results written to %s\n", out.c_str());
+    return 0;
+}
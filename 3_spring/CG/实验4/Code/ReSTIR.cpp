@@ -0,0 +1,181 @@
+//
+// ReSTIR direct lighting.
+//
+
+#include "ReSTIR.hpp"
+
+namespace {
+
+inline float luminance(const Vector3f &v) { return 0.2126f * v.x + 0.7152f * v.y + 0.0722f * v.z; }
+
+}
+
+ReSTIRIntegrator::ReSTIRIntegrator(const Scene &scene, const Camera &camera)
+    : scene(scene), camera(camera)
+{}
+
+Vector3f ReSTIRIntegrator::unshadowed(const ShadingPoint &x, const LightSample &s) const
+{
+    Vector3f toLight = s.p - x.p;
+    float dist2 = dotProduct(toLight, toLight);
+    if (dist2 <= 0)
+        return Vector3f();
+    Vector3f dir = toLight / std::sqrt(dist2);
+    float cosLight = dotProduct(-dir, s.n);
+    float cosSurface = x.frame.cosTheta(dir);
+    if (cosLight <= 0 || cosSurface <= 0)
+        return Vector3f();
+    return s.emit * x.m->eval(x.wi, dir, x.frame) * (cosSurface * cosLight / dist2);
+}
+
+float ReSTIRIntegrator::targetPdf(const ShadingPoint &x, const LightSample &s) const
+{
+    return luminance(unshadowed(x, s));
+}
+
+void ReSTIRIntegrator::finalize(Reservoir &r, const ShadingPoint &x) const
+{
+    float p = targetPdf(x, r.y);
+    r.W = p > 0 && r.M > 0 ? r.wSum / (r.M * p) : 0.0f;
+}
+
+void ReSTIRIntegrator::combine(Reservoir &into, const Reservoir &from, const ShadingPoint &x, float u) const
+{
+    // biased combination: the neighbour's sample is reweighted by our own
+    // target pdf, without checking whether it could have produced it
+    float M = into.M;
+    into.update(from.y, targetPdf(x, from.y) * from.W * from.M, u);
+    into.M = M + from.M;
+}
+
+bool ReSTIRIntegrator::similar(const ShadingPoint &a, const ShadingPoint &b) const
+{
+    return a.m && b.m && dotProduct(a.frame.n, b.frame.n) > 0.9f
+        && std::fabs(a.depth - b.depth) < 0.1f * a.depth;
+}
+
+bool ReSTIRIntegrator::renderImage(std::vector<Vector3f> &framebuffer, const Sampler &samplerProto,
+                                   int passes) const
+{
+    const int width = camera.width, height = camera.height, n = width * height;
+    std::vector<ShadingPoint> points(n), prevPoints(n);
+    std::vector<Reservoir> reservoirs(n), spatial(n), history(n);
+    std::vector<Vector3f> emitted(n);
+    IndependentSampler reuseSamplerProto(0x7e571);
+
+    for (int pass = 0; pass < passes; ++pass) {
+        // 1. shading points and initial candidates, merged with last pass
+        #pragma omp parallel
+        {
+            std::unique_ptr<Sampler> sampler = samplerProto.clone();
+            #pragma omp for schedule(dynamic, 16)
+            for (int idx = 0; idx < n; ++idx) {
+                int i = idx % width, j = idx / width;
+                sampler->startPixelSample(i, j, pass);
+                Vector2f jitter = sampler->getPixel2D();
+                Ray ray = camera.generateRay(i + jitter.x, j + jitter.y);
+
+                ShadingPoint &x = points[idx];
+                x = ShadingPoint();
+                emitted[idx] = Vector3f();
+                Vector3f beta(1.0f);
+                float depth = 0.0f;
+                for (int bounce = 0; bounce < maxDepth; ++bounce) {
+                    Intersection isect = scene.intersect(ray);
+                    if (!isect.happened)
+                        break;
+                    depth += isect.distance;
+                    if (isect.m->hasEmission()) {
+                        emitted[idx] = beta * isect.m->getEmission();
+                        break;
+                    }
+                    Frame frame(isect.normal);
+                    if (isect.m->getType() != MIRROR) {
+                        x.p = isect.coords;
+                        x.wi = ray.direction;
+                        x.beta = beta;
+                        x.frame = frame;
+                        x.m = isect.m;
+                        x.depth = depth;
+                        break;
+                    }
+                    BSDFSample bs = isect.m->sample(ray.direction, frame, sampler->get2D());
+                    if (bs.pdf <= 0)
+                        break;
+                    beta *= bs.weight;
+                    ray = Ray(isect.coords, bs.wo);
+                }
+
+                Reservoir &r = reservoirs[idx];
+                r = Reservoir();
+                if (!x.m)
+                    continue;
+                for (int k = 0; k < candidates; ++k) {
+                    Intersection pos;
+                    float pdf = 0.0f;
+                    scene.sampleLight(x.p, x.frame.n, pos, pdf, sampler->get2D());
+                    float u = sampler->get1D();
+                    if (pdf <= 0)
+                        continue;
+                    LightSample s{pos.coords, pos.normal, pos.emit};
+                    r.update(s, targetPdf(x, s) / pdf, u);
+                }
+                r.M = candidates;
+                finalize(r, x);
+
+                if (pass > 0 && similar(x, prevPoints[idx]) && history[idx].M > 0) {
+                    Reservoir prev = history[idx];
+                    prev.M = std::min(prev.M, (float)(temporalHistory * candidates));
+                    combine(r, prev, x, sampler->get1D());
+                    finalize(r, x);
+                }
+            }
+        }
+
+        // 2. spatial reuse from a few random neighbours
+        #pragma omp parallel
+        {
+            std::unique_ptr<Sampler> sampler = reuseSamplerProto.clone();
+            #pragma omp for schedule(dynamic, 16)
+            for (int idx = 0; idx < n; ++idx) {
+                const ShadingPoint &x = points[idx];
+                spatial[idx] = reservoirs[idx];
+                if (!x.m)
+                    continue;
+                sampler->startPixelSample(idx % width, idx / width, pass);
+                Reservoir &r = spatial[idx];
+                for (int k = 0; k < spatialNeighbours; ++k) {
+                    Vector2f u = sampler->get2D();
+                    float radius = spatialRadius * std::sqrt(u.x), phi = 2 * M_PI * u.y;
+                    int i = idx % width + (int)std::lround(radius * std::cos(phi));
+                    int j = idx / width + (int)std::lround(radius * std::sin(phi));
+                    if (i < 0 || i >= width || j < 0 || j >= height)
+                        continue;
+                    int nIdx = j * width + i;
+                    if (nIdx == idx || !similar(x, points[nIdx]) || reservoirs[nIdx].M <= 0)
+                        continue;
+                    combine(r, reservoirs[nIdx], x, sampler->get1D());
+                }
+                finalize(r, x);
+            }
+        }
+
+        // 3. one shadow ray per pixel for the chosen sample
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int idx = 0; idx < n; ++idx) {
+            const ShadingPoint &x = points[idx];
+            const Reservoir &r = spatial[idx];
+            Vector3f L = emitted[idx];
+            // the reservoir is kept even if occluded here: dropping its weight
+            // but not its M darkens every partially shadowed pixel
+            if (x.m && r.W > 0 && scene.visible(x.p, r.y.p))
+                L += x.beta * unshadowed(x, r.y) * r.W;
+            framebuffer[idx] += L / passes;
+        }
+
+        history.swap(spatial);
+        prevPoints.swap(points);
+        UpdateProgress((pass + 1) / (float)passes);
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+//
+// Reservoir-based spatiotemporal importance resampling for direct lighting
+// (Bitterli et al. 2020). Each pass draws many unshadowed light candidates
+// per pixel into a reservoir, merges it with the pixel's reservoir from the
+// previous pass and with a few screen-space neighbours, then traces a single
+// shadow ray for the sample that survived.
+//
+// This mode renders emission plus direct light at the first non-mirror hit;
+// it is meant for studying direct-lighting noise, not as a full integrator.
+//
+
+#ifndef RAYTRACING_RESTIR_H
+#define RAYTRACING_RESTIR_H
+
+#include <vector>
+#include "Integrator.hpp"
+
+class ReSTIRIntegrator : public Integrator
+{
+public:
+    ReSTIRIntegrator(const Scene &scene, const Camera &camera);
+
+    // Reuse needs the neighbouring pixels, so only whole passes work.
+    Vector3f Li(const Ray &ray, Sampler &sampler) const override { return Vector3f(); }
+    bool renderImage(std::vector<Vector3f> &framebuffer, const Sampler &sampler, int passes) const override;
+
+    int maxDepth = 10;          // mirror bounces before the shading point
+    int candidates = 32;        // light samples streamed into each reservoir
+    int spatialNeighbours = 5;
+    float spatialRadius = 30.0f; // pixels
+    // The previous pass's M is clamped to this many times `candidates`. Long
+    // histories clean up a single pass but correlate the passes averaged
+    // into the image, so the default is short.
+    int temporalHistory = 4;
+
+private:
+    struct LightSample
+    {
+        Vector3f p, n, emit;
+    };
+
+    struct Reservoir
+    {
+        LightSample y;
+        float wSum = 0.0f;
+        float M = 0.0f;
+        float W = 0.0f;
+
+        bool update(const LightSample &s, float w, float u)
+        {
+            wSum += w;
+            M += 1;
+            if (w > 0 && u * wSum < w) {
+                y = s;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    struct ShadingPoint
+    {
+        Vector3f p, wi, beta;
+        Frame frame;
+        Material *m = nullptr;
+        float depth = 0.0f;
+    };
+
+    // Unshadowed contribution of s at x and its luminance, the target pdf.
+    Vector3f unshadowed(const ShadingPoint &x, const LightSample &s) const;
+    float targetPdf(const ShadingPoint &x, const LightSample &s) const;
+    void finalize(Reservoir &r, const ShadingPoint &x) const;
+    // Folds `from` (built at another shading point) into `into`, shading at x.
+    void combine(Reservoir &into, const Reservoir &from, const ShadingPoint &x, float u) const;
+    bool similar(const ShadingPoint &a, const ShadingPoint &b) const;
+
+    const Scene &scene;
+    const Camera &camera;
+};
+
+#endif //RAYTRACING_RESTIR_H
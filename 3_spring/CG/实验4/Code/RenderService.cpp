@@ -0,0 +1,301 @@
+//
+// Render daemon: scene cache, fair tile scheduler and client protocol.
+//
+
+#include <iostream>
+#include <sstream>
+#include "RenderService.hpp"
+#include "Socket.hpp"
+#include "ImageIO.hpp"
+#include "Profiler.hpp"
+
+struct RenderService::Job {
+    const Scene *scene;
+    Camera camera;
+    int spp;
+    std::unique_ptr<Sampler> sampler;
+    std::unique_ptr<PathIntegrator> integrator;
+
+    // guarded by RenderService::queueMutex
+    std::deque<Tile> pending;
+    std::atomic<bool> cancelled{false};
+
+    // rendered tiles waiting to be sent; `remaining` counts tiles not yet
+    // rendered or skipped
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+    std::deque<std::pair<Tile, std::vector<float>>> done;
+    int remaining = 0;
+
+    Job(const Scene *scene, const Camera &camera, int spp)
+        : scene(scene), camera(camera), spp(spp) {}
+};
+
+void renderTile(const Camera &camera, const Integrator &integrator, const Sampler &samplerProto, int spp,
+                int x0, int y0, int x1, int y1, std::vector<float> &rgb, const std::atomic<bool> *cancelled)
+{
+    // same sample sequence as para(), so results match a local render
+    std::unique_ptr<Sampler> sampler = samplerProto.clone();
+    rgb.clear();
+    rgb.reserve((x1 - x0) * (y1 - y0) * 3);
+    for (int j = y0; j < y1 && !(cancelled && *cancelled); ++j)
+        for (int i = x0; i < x1; ++i) {
+            Vector3f radiance;
+            for (int k = 0; k < spp; ++k) {
+                sampler->startPixelSample(i, j, k);
+                Vector2f jitter = sampler->getPixel2D();
+                radiance += integrator.Li(camera.generateRay(i + jitter.x, j + jitter.y), *sampler);
+            }
+            Vector3f c = radiance * (1.0f / spp);
+            rgb.insert(rgb.end(), { c.x, c.y, c.z });
+        }
+}
+
+RenderService::RenderService(const std::string &socketPath, int threads)
+    : socketPath(socketPath)
+{
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; ++i)
+        workers.emplace_back(&RenderService::worker, this);
+}
+
+RenderService::~RenderService()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCv.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+int RenderService::run()
+{
+    int listenFd = listenUnix(socketPath);
+    if (listenFd < 0)
+        return 1;
+    std::cout << "serving on " << socketPath << " with " << workers.size() << " threads\n";
+    for (;;) {
+        int fd = acceptConnection(listenFd);
+        if (fd < 0)
+            return 1;
+        std::thread(&RenderService::serveClient, this, fd).detach();
+    }
+}
+
+// Takes one tile from the job at the front and moves that job to the back,
+// so every running job advances by one tile per turn.
+void RenderService::worker()
+{
+    profiler::nameThread("service worker");
+    for (;;) {
+        std::shared_ptr<Job> job;
+        Tile tile;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            job = queue.front();
+            queue.pop_front();
+            tile = job->pending.front();
+            job->pending.pop_front();
+            if (!job->pending.empty())
+                queue.push_back(job);
+        }
+
+        std::vector<float> pixels;
+        if (!job->cancelled) {
+            PROFILE_ZONE("service tile", tile.y0);
+            renderTile(job->camera, *job->integrator, *job->sampler, job->spp, tile.x0, tile.y0, tile.x1, tile.y1,
+                       pixels, &job->cancelled);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(job->doneMutex);
+            if (!job->cancelled)
+                job->done.emplace_back(tile, std::move(pixels));
+            --job->remaining;
+        }
+        job->doneCv.notify_one();
+    }
+}
+
+std::shared_ptr<RenderService::Job> RenderService::startJob(const std::string &request, std::string &error)
+{
+    std::istringstream in(request);
+    std::string command, path;
+    if (!(in >> command >> path) || command != "render") {
+        error = "expected: render <scene> [options]";
+        return nullptr;
+    }
+
+    const Scene *scene;
+    Renderer settings;
+    {
+        // loading is serialized; a scene is built once and then shared
+        std::lock_guard<std::mutex> lock(sceneMutex);
+        auto it = scenes.find(path);
+        if (it == scenes.end()) {
+            LoadedScene loaded;
+            loaded.scene = loader.load(path, {}, loaded.settings);
+            if (!loaded.scene) {
+                error = "cannot load " + path;
+                return nullptr;
+            }
+            it = scenes.emplace(path, std::move(loaded)).first;
+        }
+        scene = it->second.scene.get();
+        settings = it->second.settings;
+    }
+
+    int spp = settings.spp, tileSize = 32;
+    int width = scene->width, height = scene->height;
+    Vector3f eye = settings.eye;
+    int region[4] = { 0, 0, -1, -1 };
+    std::string option;
+    while (in >> option) {
+        bool ok;
+        if (option == "spp")
+            ok = (bool)(in >> spp) && spp > 0;
+        else if (option == "tile")
+            ok = (bool)(in >> tileSize) && tileSize > 0;
+        else if (option == "eye")
+            ok = (bool)(in >> eye.x >> eye.y >> eye.z);
+        else if (option == "resolution")
+            ok = (bool)(in >> width >> height) && width > 0 && height > 0;
+        else if (option == "region")
+            ok = (bool)(in >> region[0] >> region[1] >> region[2] >> region[3]);
+        else
+            ok = false;
+        if (!ok) {
+            error = "bad option " + option;
+            return nullptr;
+        }
+    }
+    int x0 = std::max(region[0], 0), y0 = std::max(region[1], 0);
+    int x1 = region[2] < 0 ? width : std::min(region[2], width);
+    int y1 = region[3] < 0 ? height : std::min(region[3], height);
+    if (x0 >= x1 || y0 >= y1) {
+        error = "empty region";
+        return nullptr;
+    }
+
+    auto job = std::make_shared<Job>(scene, Camera(eye, scene->fov, width, height), spp);
+    job->sampler = makeSampler(settings.samplerType, spp);
+    job->integrator = std::make_unique<PathIntegrator>(*scene);
+    for (int ty = y0; ty < y1; ty += tileSize)
+        for (int tx = x0; tx < x1; tx += tileSize)
+            job->pending.push_back({ tx, ty, std::min(tx + tileSize, x1), std::min(ty + tileSize, y1) });
+    job->remaining = (int)job->pending.size();
+    return job;
+}
+
+void RenderService::cancel(const std::shared_ptr<Job> &job)
+{
+    job->cancelled = true;
+    std::lock_guard<std::mutex> lock(queueMutex);
+    for (auto it = queue.begin(); it != queue.end(); ++it)
+        if (*it == job) {
+            // tiles never handed out will not report back
+            std::lock_guard<std::mutex> doneLock(job->doneMutex);
+            job->remaining -= (int)job->pending.size();
+            job->pending.clear();
+            queue.erase(it);
+            break;
+        }
+}
+
+void RenderService::serveClient(int fd)
+{
+    Connection conn(fd);
+    std::string request, error;
+    if (!conn.readLine(request))
+        return;
+    std::shared_ptr<Job> job = startJob(request, error);
+    if (!job) {
+        conn.writeLine("error " + error);
+        return;
+    }
+    std::cout << "job: " << request << " (" << job->remaining << " tiles)\n";
+    bool ok = conn.writeLine("ok " + std::to_string(job->camera.width) + " " + std::to_string(job->camera.height) +
+                             " " + std::to_string(job->remaining));
+    if (ok) {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(job);
+    }
+    queueCv.notify_all();
+
+    while (ok) {
+        std::unique_lock<std::mutex> lock(job->doneMutex);
+        // wake up now and then to notice clients that hang up mid-job
+        if (!job->doneCv.wait_for(lock, std::chrono::milliseconds(100),
+                                  [&] { return !job->done.empty() || job->remaining == 0; })) {
+            lock.unlock();
+            ok = !conn.peerClosed();
+            continue;
+        }
+        if (job->done.empty())
+            break;
+        auto tile = std::move(job->done.front());
+        job->done.pop_front();
+        lock.unlock();
+
+        const Tile &t = tile.first;
+        std::ostringstream header;
+        header << "tile " << t.x0 << " " << t.y0 << " " << t.x1 - t.x0 << " " << t.y1 - t.y0;
+        ok = conn.writeLine(header.str()) &&
+             conn.writeAll(tile.second.data(), tile.second.size() * sizeof(float));
+    }
+    if (ok)
+        conn.writeLine("done");
+    else
+        cancel(job);
+}
+
+int submitRender(const std::string &socketPath, const std::string &request, const std::string &output)
+{
+    Connection conn(connectUnix(socketPath));
+    std::string line;
+    if (!conn.valid() || !conn.writeLine(request) || !conn.readLine(line)) {
+        std::cerr << "no answer from " << socketPath << "\n";
+        return 1;
+    }
+    std::istringstream status(line);
+    std::string word;
+    int width, height, tiles;
+    if (!(status >> word >> width >> height >> tiles) || word != "ok") {
+        std::cerr << "render service: " << line << "\n";
+        return 1;
+    }
+
+    std::vector<Vector3f> image(width * height);
+    std::vector<float> pixels;
+    int received = 0;
+    while (conn.readLine(line) && line.rfind("tile ", 0) == 0) {
+        std::istringstream header(line.substr(5));
+        int x0, y0, w, h;
+        if (!(header >> x0 >> y0 >> w >> h) || x0 < 0 || y0 < 0 || w <= 0 || h <= 0 ||
+            x0 + w > width || y0 + h > height)
+            break;
+        pixels.resize(w * h * 3);
+        if (!conn.readExact(pixels.data(), pixels.size() * sizeof(float)))
+            break;
+        for (int j = 0; j < h; ++j)
+            for (int i = 0; i < w; ++i) {
+                const float *p = &pixels[(j * w + i) * 3];
+                image[(y0 + j) * width + x0 + i] = Vector3f(p[0], p[1], p[2]);
+            }
+        ++received;
+    }
+    if (line != "done" || received != tiles) {
+        std::cerr << "render service: " << (line.empty() ? "connection lost" : line) << " after "
+                  << received << "/" << tiles << " tiles\n";
+        return 1;
+    }
+    bool written = writePPM((output + ".ppm").c_str(), image, width, height, 0.6f) &&
+                   writePFM((output + ".pfm").c_str(), image, width, height);
+    return written ? 0 : 1;
+}
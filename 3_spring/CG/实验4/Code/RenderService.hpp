@@ -0,0 +1,83 @@
+//
+// Long-running render daemon. Scenes (with their meshes and BVHs) stay
+// resident between requests; clients connect over a Unix domain socket,
+// send one request line and get the image streamed back tile by tile.
+// Tiles of all running jobs go through one worker pool in round-robin
+// order, so concurrent jobs share the cores evenly.
+//
+// Request (one line):
+//   render <scene file> [spp N] [eye X Y Z] [resolution W H]
+//          [region X0 Y0 X1 Y1] [tile N]
+// Response:
+//   ok <width> <height> <tiles>
+//   tile <x0> <y0> <w> <h>     followed by w*h*3 floats (RGB, row-major)
+//   ...
+//   done                       or "error <message>" at any point
+//
+
+#ifndef RAYTRACING_RENDERSERVICE_H
+#define RAYTRACING_RENDERSERVICE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SceneFile.hpp"
+#include "Camera.hpp"
+
+// Path traces pixels [x0, x1) x [y0, y1) into rgb (row-major RGB means).
+// Stops early, leaving rgb short, once *cancelled is set.
+void renderTile(const Camera &camera, const Integrator &integrator, const Sampler &samplerProto, int spp,
+                int x0, int y0, int x1, int y1, std::vector<float> &rgb,
+                const std::atomic<bool> *cancelled = nullptr);
+
+class RenderService
+{
+public:
+    // threads <= 0 uses every hardware thread.
+    RenderService(const std::string &socketPath, int threads);
+    ~RenderService();
+
+    // Accepts clients until the listening socket fails; returns an exit code.
+    int run();
+
+private:
+    struct Job;
+    struct Tile {
+        int x0, y0, x1, y1;
+    };
+    struct LoadedScene {
+        std::unique_ptr<Scene> scene;
+        Renderer settings;
+    };
+
+    void worker();
+    void serveClient(int fd);
+    std::shared_ptr<Job> startJob(const std::string &request, std::string &error);
+    void cancel(const std::shared_ptr<Job> &job);
+
+    std::string socketPath;
+
+    // scenes are loaded once and then only read
+    std::mutex sceneMutex;
+    SceneLoader loader;
+    std::map<std::string, LoadedScene> scenes;
+
+    // jobs with tiles left, served round-robin one tile at a time
+    std::mutex queueMutex;
+    std::condition_variable queueCv;
+    std::deque<std::shared_ptr<Job>> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+// Sends `request` to the daemon at socketPath, assembles the streamed tiles
+// and writes <output>.ppm / .pfm. Returns an exit code.
+int submitRender(const std::string &socketPath, const std::string &request, const std::string &output);
+
+#endif //RAYTRACING_RENDERSERVICE_H
@@ -5,6 +5,19 @@
 #include <fstream>
 #include "Scene.hpp"
 #include "Renderer.hpp"
+#include "Simd.hpp"
+#include "BDPT.hpp"
+#include "SPPM.hpp"
+#include "Guiding.hpp"
+#include "ReSTIR.hpp"
+#include "IrradianceCache.hpp"
+#include "Denoiser.hpp"
+#include "ImageIO.hpp"
+#include "TiledFramebuffer.hpp"
+#include "TraversalStats.hpp"
+#include "Telemetry.hpp"
+#include "Profiler.hpp"
+#include <chrono>
 #include <thread>
 #include <mutex>
 #include <omp.h>
@@ -14,31 +27,197 @@ inline float deg2rad(const float& deg) { return deg * M_PI / 180.0; }
 
 const float EPSILON = 0.00016;
 
-int prog = 0;
-std::mutex lock;
-omp_lock_t lock1;
+inline float luminance(const Vector3f &v) { return 0.2126f * v.x + 0.7152f * v.y + 0.0722f * v.z; }
 
-void para(Vector3f eye_pos, std::vector<Vector3f> &framebuffer, const Scene& scene, int spp, float imageAspectRatio, float scale, int start, int end){
-    int width, height;
-    width = height = sqrt(spp);
-    float step = 1.0f / width;
+// Renders samples [k0, k1) of rows [start, end) and folds them into the
+// running mean in framebuffer, which already holds k0 samples per pixel.
+// moment2, if given, gets the same running mean of squared luminance.
+void para(const Camera &camera, std::vector<Vector3f> &framebuffer, const Scene& scene, int k0, int k1, int start,
+          int end, const Sampler &samplerProto, const Integrator &integrator, ImageWriter &writer,
+          [[maybe_unused]] stats::TraversalImage *traversal, telemetry::Reporter &reporter, std::vector<float> *moment2){
+    std::unique_ptr<Sampler> sampler = samplerProto.clone();
+    std::vector<Vector3f> row(scene.width);
+    std::vector<float> rowSq(scene.width);
     for (uint32_t j = start; j < end; ++j) {
+        PROFILE_ZONE("render row", j);
+        telemetry::BusyScope busy;
         for (uint32_t i = 0; i < scene.width; ++i) {
             // generate primary ray direction   
-            for (int k = 0; k < spp; k++){
-                float x = (2 * (i + step / 2 + step * (k % width)) / (float)scene.width - 1) *
-                        imageAspectRatio * scale;
-                float y = (1 - 2 * (j + step / 2 + step * (k / height)) / (float)scene.height) * scale;
-                Vector3f dir = normalize(Vector3f(-x, y, 1));
-                framebuffer[j * scene.width + i] += scene.castRay(Ray(eye_pos, dir), 0) / spp;  
+            Vector3f radiance;
+#if RAYTRACING_TRAVERSAL_STATS
+            stats::Counters before = stats::local();
+#endif
+            float sq = 0;
+            for (int k = k0; k < k1; k++){
+                sampler->startPixelSample(i, j, k);
+                Vector2f jitter = sampler->getPixel2D();
+                Vector3f L = integrator.Li(camera.generateRay(i + jitter.x, j + jitter.y), *sampler);
+                radiance += L;
+                sq += luminance(L) * luminance(L);
+            }
+            rowSq[i] = sq;
+#if RAYTRACING_TRAVERSAL_STATS
+            traversal->record(i, j, stats::local() - before, k1 - k0);
+#endif
+            row[i] = radiance;
+        }
+        if (k0 > 0)
+            simd::scale(&framebuffer[j * scene.width], k0 / (float)k1, scene.width);
+        simd::accumulate(&framebuffer[j * scene.width], row.data(), 1.0f / k1, scene.width);
+        if (moment2)
+            for (uint32_t i = 0; i < scene.width; ++i) {
+                float &m = (*moment2)[j * scene.width + i];
+                m = (m * k0 + rowSq[i]) / k1;
+            }
+        writer.rowsDone(j, j + 1);
+        reporter.workDone(k1 - k0);
+    }
+}
+
+// A band of rows rendered as one unit. In budget mode every band keeps its
+// own sample count and error estimate.
+struct RowBlock {
+    int y0, y1;
+    int samples = 0;
+    float error = std::numeric_limits<float>::infinity();
+};
+
+// Relative RMS standard error of the pixel means in a block:
+// sqrt(mean(variance / n)) / mean luminance. Below 8 samples the variance
+// itself is too noisy to stop on.
+float blockError(const std::vector<Vector3f> &framebuffer, const std::vector<float> &moment2, int width,
+                 const RowBlock &b)
+{
+    if (b.samples < 8)
+        return std::numeric_limits<float>::infinity();
+    double variance = 0, mean = 0;
+    for (int idx = b.y0 * width; idx < b.y1 * width; ++idx) {
+        float l = luminance(framebuffer[idx]);
+        variance += std::max(0.0f, moment2[idx] - l * l) * b.samples / (b.samples - 1);
+        mean += l;
+    }
+    int n = (b.y1 - b.y0) * width;
+    return std::sqrt(variance / n / b.samples) / std::max(mean / n, 1e-4);
+}
+
+// Achieved spp and error for every block, on the console and in <output>_tiles.txt.
+void reportBlocks(const std::vector<RowBlock> &blocks, const std::string &output)
+{
+    int minSpp = blocks[0].samples, maxSpp = 0;
+    double meanSpp = 0, meanError = 0, maxError = 0;
+    FILE *fp = fopen((output + "_tiles.txt").c_str(), "w");
+    if (fp)
+        fprintf(fp, "# y0 y1 spp relative_error\n");
+    for (const RowBlock &b : blocks) {
+        minSpp = std::min(minSpp, b.samples);
+        maxSpp = std::max(maxSpp, b.samples);
+        meanSpp += b.samples / (double)blocks.size();
+        meanError += b.error / blocks.size();
+        maxError = std::max(maxError, (double)b.error);
+        if (fp)
+            fprintf(fp, "%d %d %d %.5f\n", b.y0, b.y1, b.samples, b.error);
+    }
+    if (fp)
+        fclose(fp);
+    printf("achieved spp min %d / mean %.1f / max %d, relative error mean %.4f / max %.4f (%s_tiles.txt)\n",
+           minSpp, meanSpp, maxSpp, meanError, maxError, output.c_str());
+}
+
+// Out-of-core path: workers take whole tiles, render every sample of a tile
+// into a small local buffer, store it in the mapped file and evict it, so
+// only about one tile per thread is ever resident.
+void renderTiled(const Camera &camera, const Scene &scene, int spp, int tileSize, const Sampler &samplerProto,
+                 const Integrator &integrator, const std::string &output, const std::string &statsFile)
+{
+    TiledFramebuffer framebuffer(output + ".fb", scene.width, scene.height, tileSize);
+    if (!framebuffer.valid())
+        return;
+    const int tilesX = framebuffer.tilesX(), tileCount = tilesX * framebuffer.tilesY();
+    telemetry::Reporter reporter(tileCount, statsFile);
+    #pragma omp parallel
+    {
+        std::unique_ptr<Sampler> sampler = samplerProto.clone();
+        std::vector<Vector3f> tile(tileSize * tileSize);
+        #pragma omp for schedule(dynamic, 1)
+        for (int t = 0; t < tileCount; ++t) {
+            PROFILE_ZONE("render tile", t);
+            telemetry::BusyScope busy;
+            int tx = t % tilesX, ty = t / tilesX;
+            int x0 = tx * tileSize, y0 = ty * tileSize;
+            int x1 = std::min(x0 + tileSize, scene.width), y1 = std::min(y0 + tileSize, scene.height);
+            for (int j = y0; j < y1; ++j)
+                for (int i = x0; i < x1; ++i) {
+                    Vector3f radiance;
+                    for (int k = 0; k < spp; k++) {
+                        sampler->startPixelSample(i, j, k);
+                        Vector2f jitter = sampler->getPixel2D();
+                        radiance += integrator.Li(camera.generateRay(i + jitter.x, j + jitter.y), *sampler);
+                    }
+                    tile[(j - y0) * tileSize + i - x0] = radiance / spp;
+                }
+            for (int j = y0; j < y1; ++j)
+                for (int i = x0; i < x1; ++i) {
+                    const Vector3f &c = tile[(j - y0) * tileSize + i - x0];
+                    float *p = framebuffer.pixel(i, j);
+                    p[0] = c.x, p[1] = c.y, p[2] = c.z;
+                }
+            framebuffer.evictTile(tx, ty);
+            reporter.workDone();
+        }
+    }
+    reporter.stop();
+    if (!framebuffer.writeImages(output, 0.6f))
+        std::cerr << "failed to write " << output << ".ppm / .pfm\n";
+}
+
+// First non-mirror hit of a few jittered rays per pixel.
+void renderAOVs(const Camera &camera, const Scene &scene, const Sampler &samplerProto, AOVs &aovs, int samples)
+{
+    PROFILE_ZONE("AOVs");
+    const int n = scene.width * scene.height;
+    aovs.albedo.assign(n, Vector3f());
+    aovs.normal.assign(n, Vector3f());
+    aovs.depth.assign(n, 0.0f);
+    #pragma omp parallel
+    {
+        std::unique_ptr<Sampler> sampler = samplerProto.clone();
+        #pragma omp for schedule(dynamic, 4)
+        for (int j = 0; j < scene.height; ++j) {
+            for (int i = 0; i < scene.width; ++i) {
+                Vector3f albedo, normal;
+                float depth = 0;
+                for (int k = 0; k < samples; ++k) {
+                    sampler->startPixelSample(i, j, k);
+                    Vector2f jitter = sampler->getPixel2D();
+                    Ray ray = camera.generateRay(i + jitter.x, j + jitter.y);
+                    Vector3f beta(1.0f);
+                    float dist = 0;
+                    for (int bounce = 0; bounce < 8; ++bounce) {
+                        Intersection isect = scene.intersect(ray);
+                        if (!isect.happened)
+                            break;
+                        dist += isect.distance;
+                        Material *m = isect.m;
+                        if (m->getType() == MIRROR && !m->hasEmission()) {
+                            BSDFSample bs = m->sample(ray.direction, Frame(isect.normal), sampler->get2D());
+                            if (bs.pdf <= 0)
+                                break;
+                            beta *= bs.weight;
+                            ray = Ray(isect.coords, bs.wo);
+                            continue;
+                        }
+                        albedo += beta * (m->hasEmission() ? Vector3f(1.0f) : m->getType() == GLOSSY ? m->Ks : m->Kd);
+                        normal += isect.normal;
+                        depth += dist;
+                        break;
+                    }
+                }
+                int idx = j * scene.width + i;
+                aovs.albedo[idx] = albedo / samples;
+                aovs.normal[idx] = normal / samples;
+                aovs.depth[idx] = depth / samples;
             }
         }
-        //lock.lock();
-        omp_set_lock(&lock1);
-        prog++;
-        UpdateProgress(prog / (float)scene.height);
-        omp_unset_lock(&lock1);
-        //lock.unlock();
     }
 }
 
@@ -47,55 +226,142 @@ void para(Vector3f eye_pos, std::vector<Vector3f> &framebuffer, const Scene& sce
 // framebuffer is saved to a file.
 void Renderer::Render(const Scene& scene)
 {
-    std::vector<Vector3f> framebuffer(scene.width * scene.height);
-
-    float scale = tan(deg2rad(scene.fov * 0.5));
-    float imageAspectRatio = scene.width / (float)scene.height;
-    Vector3f eye_pos(278, 273, -800);
-    int m = 0;
-    int thread_num = 32;
-    int thread_step = scene.height / thread_num;
-    std::vector<std::thread> rays;
-    // change the spp value to change sample ammount
-    int spp = 10000;
+    Vector3f eye_pos = eye;
+    if (threads > 0)
+        omp_set_num_threads(threads);
+    // rows per block handed to a worker; 32 blocks unless a tile size is set
+    int thread_step = tileSize > 0 ? tileSize : std::max(1, scene.height / 32);
+    int thread_num = (scene.height + thread_step - 1) / thread_step;
+    Camera camera(eye_pos, scene.fov, scene.width, scene.height);
+    // Budget mode needs every pixel to be independent of the others: light
+    // tracing splats (bdpt) are normalized by one spp for the whole image,
+    // and whole-image integrators do not render in row blocks.
+    const bool pixelIndependent = mode == RenderMode::PathTracing || mode == RenderMode::IrradianceCache;
+    bool budget = timeBudget > 0 || noiseTarget > 0;
+    if (budget && !pixelIndependent) {
+        std::cout << "--time and --noise need path tracing or irrcache; rendering all " << spp << " spp\n";
+        budget = false;
+    }
+    // budget passes stop at any power of two, so the sampler must not spread
+    // the spp upper limit over the first few samples
+    std::unique_ptr<Sampler> sampler = makeSampler(samplerType, budget ? 0 : spp);
+    std::unique_ptr<Integrator> integrator;
+    if (mode == RenderMode::BDPT)
+        integrator = std::make_unique<BDPTIntegrator>(scene, camera);
+    else if (mode == RenderMode::SPPM)
+        integrator = std::make_unique<SPPMIntegrator>(scene, camera);
+    else if (mode == RenderMode::Guided)
+        integrator = std::make_unique<GuidedPathIntegrator>(scene, camera);
+    else if (mode == RenderMode::ReSTIR)
+        integrator = std::make_unique<ReSTIRIntegrator>(scene, camera);
+    else if (mode == RenderMode::IrradianceCache)
+        integrator = std::make_unique<IrradianceCacheIntegrator>(scene, camera);
+    else
+        integrator = std::make_unique<PathIntegrator>(scene);
     std::cout << "SPP: " << spp << "\n";
-    /*int width, height;
-    width = height = sqrt(spp);
-    float step = 1.0f / width;
-    for (uint32_t j = 0; j < scene.height; ++j) {
-        for (uint32_t i = 0; i < scene.width; ++i) {
-            // generate primary ray direction   
-            for (int k = 0; k < spp; k++){
-                float x = (2 * (i + step / 2 + step * (k % width)) / (float)scene.width - 1) *
-                        imageAspectRatio * scale;
-                float y = (1 - 2 * (j + step / 2 + step * (k / height)) / (float)scene.height) * scale;
-                Vector3f dir = normalize(Vector3f(-x, y, 1));
-                framebuffer[m] += scene.castRay(Ray(eye_pos, dir), 0) / spp;  
+    std::cout << "SIMD: " << simd::isaName(simd::activeISA()) << "\n";
+    // pixel-independent integrators can keep the image on disk instead
+    if (outOfCore && pixelIndependent && !denoise && !budget) {
+        renderTiled(camera, scene, spp, tileSize > 0 ? tileSize : 64, *sampler, *integrator, output, statsFile);
+        return;
+    }
+    if (outOfCore)
+        std::cout << "out-of-core framebuffer needs path tracing or irrcache without denoise or a budget; "
+                     "rendering in memory\n";
+    std::vector<Vector3f> framebuffer(scene.width * scene.height);
+    // <output>.ppm / .pfm are filled in row by row as rows finish
+    ImageWriter writer(output, framebuffer, scene.width, scene.height, 0.6f);
+    // per-pixel traversal cost, only kept in RAYTRACING_TRAVERSAL_STATS builds
+    std::unique_ptr<stats::TraversalImage> traversal;
+    if (RAYTRACING_TRAVERSAL_STATS)
+        traversal = std::make_unique<stats::TraversalImage>(scene.width, scene.height);
+    bool wholeImage;
+    {
+        PROFILE_ZONE("renderImage");
+        wholeImage = integrator->renderImage(framebuffer, *sampler, spp);
+    }
+    if (!wholeImage) {
+        // in budget mode the work is only known one pass at a time
+        telemetry::Reporter reporter(budget ? 0 : (long)scene.height * spp, statsFile);
+        std::vector<float> moment2(budget ? framebuffer.size() : 0);
+        std::vector<RowBlock> blocks;
+        for (int i = 0; i < thread_num; i++)
+            blocks.push_back({ i * thread_step, std::min(scene.height, (i + 1) * thread_step) });
+        // In budget mode every pass doubles the sample count of each block
+        // (1, 2, 4, ...), blocks drop out once their error is below
+        // noiseTarget, and no pass is started that would overrun timeBudget.
+        // spp is the upper limit either way.
+        auto start = std::chrono::steady_clock::now();
+        double secondsPerSample = 0;
+        bool outOfTime = false;
+        while (true) {
+            std::vector<std::pair<RowBlock*, int>> work;
+            double pixelSamples = 0;
+            long rowSamples = 0;
+            for (RowBlock &b : blocks) {
+                if (b.samples >= spp || (budget && noiseTarget > 0 && b.error <= noiseTarget))
+                    continue;
+                int k1 = budget ? std::min(spp, std::max(1, 2 * b.samples)) : spp;
+                work.push_back({ &b, k1 });
+                pixelSamples += (double)(b.y1 - b.y0) * scene.width * (k1 - b.samples);
+                rowSamples += (long)(b.y1 - b.y0) * (k1 - b.samples);
+            }
+            if (work.empty())
+                break;
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (budget && timeBudget > 0 && secondsPerSample > 0 &&
+                elapsed + secondsPerSample * pixelSamples > timeBudget) {
+                outOfTime = true;
+                break;
             }
-            m++;
+            if (budget)
+                reporter.addWork(rowSamples);
+        #pragma omp parallel for schedule(dynamic, 1)
+            for (int i = 0; i < (int)work.size(); i++) {
+                RowBlock &b = *work[i].first;
+                para(camera, std::ref(framebuffer), std::ref(scene), b.samples, work[i].second, b.y0, b.y1,
+                        *sampler, *integrator, writer, traversal.get(), reporter, budget ? &moment2 : nullptr);
+                b.samples = work[i].second;
+                if (budget)
+                    b.error = blockError(framebuffer, moment2, scene.width, b);
+            }
+            secondsPerSample = (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() -
+                                elapsed) / pixelSamples;
+        }
+        reporter.stop();
+        if (budget) {
+            if (outOfTime)
+                std::cout << "time budget reached\n";
+            reportBlocks(blocks, output);
         }
-        UpdateProgress(j / (float)scene.height);
-    }*/
-    /*for (int i = 0; i < thread_num; i++) 
-        rays.push_back(std::thread(para, eye_pos, std::ref(framebuffer), std::ref(scene), spp, 
-                    imageAspectRatio, scale, i * thread_step, (i + 1) * thread_step));
-    for (int i = 0; i < thread_num; i++) 
-        rays[i].join();*/
-    #pragma omp parallel for
-        for (int i = 0; i < thread_num; i++) 
-            para(eye_pos, std::ref(framebuffer), std::ref(scene), spp, 
-                    imageAspectRatio, scale, i * thread_step, (i + 1) * thread_step);
-    UpdateProgress(1.f);
+        if (traversal)
+            traversal->write(output + "_traversal");
+    }
+    else {
+        UpdateProgress(1.f);
+    }
+    if (integrator->finish(framebuffer, spp) || wholeImage)
+        writer.rowsDone(0, scene.height);
+    if (!writer.close())
+        std::cerr << "failed to write " << output << ".ppm / .pfm\n";
+    // raw accumulation, before any denoising
+    writeEXR((output + ".exr").c_str(), framebuffer, scene.width, scene.height);
 
-    // save framebuffer to file
-    FILE* fp = fopen("binary.ppm", "wb");
-    (void)fprintf(fp, "P6\n%d %d\n255\n", scene.width, scene.height);
-    for (auto i = 0; i < scene.height * scene.width; ++i) {
-        static unsigned char color[3];
-        color[0] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].x), 0.6f));
-        color[1] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].y), 0.6f));
-        color[2] = (unsigned char)(255 * std::pow(clamp(0, 1, framebuffer[i].z), 0.6f));
-        fwrite(color, 1, 3, fp);
+    if (denoise) {
+        AOVs aovs;
+        renderAOVs(camera, scene, *sampler, aovs, std::min(spp, 4));
+        writePPM((output + "_noisy.ppm").c_str(), framebuffer, scene.width, scene.height, 0.6f);
+        Denoiser().denoise(framebuffer, aovs, scene.width, scene.height);
+
+        std::vector<Vector3f> normals(aovs.normal.size()), depths(aovs.depth.size());
+        float maxDepth = *std::max_element(aovs.depth.begin(), aovs.depth.end());
+        for (size_t i = 0; i < normals.size(); ++i) {
+            normals[i] = aovs.normal[i] * 0.5f + Vector3f(0.5f);
+            depths[i] = Vector3f(maxDepth > 0 ? aovs.depth[i] / maxDepth : 0.0f);
+        }
+        writePPM((output + "_albedo.ppm").c_str(), aovs.albedo, scene.width, scene.height, 1.0f);
+        writePPM((output + "_normal.ppm").c_str(), normals, scene.width, scene.height, 1.0f);
+        writePPM((output + "_depth.ppm").c_str(), depths, scene.width, scene.height, 1.0f);
+        writePPM((output + ".ppm").c_str(), framebuffer, scene.width, scene.height, 0.6f);
     }
-    fclose(fp);    
 }
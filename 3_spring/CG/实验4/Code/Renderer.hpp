@@ -2,6 +2,7 @@
 // Created by goksu on 2/25/20.
 //
 #include "Scene.hpp"
+#include "Integrator.hpp"
 
 #pragma once
 struct hit_payload
@@ -17,5 +18,29 @@ class Renderer
 public:
     void Render(const Scene& scene);
 
+    // change the spp value to change sample ammount; any count works
+    int spp = 10000;
+    SamplerType samplerType = SamplerType::Sobol;
+    RenderMode mode = RenderMode::PathTracing;
+    // also write albedo/normal/depth AOVs and filter the image with them
+    bool denoise = false;
+    // accumulate into a memory-mapped tiled file (<output>.fb) instead of RAM
+    bool outOfCore = false;
+    // rows per work block in memory, tile edge out of core; 0 picks a default
+    int tileSize = 0;
+    // worker threads, 0 for the OpenMP default
+    int threads = 0;
+    // Budget mode: render in progressive passes until timeBudget seconds are
+    // used up or every row block's relative error is below noiseTarget; spp
+    // is then an upper limit
+    float timeBudget = 0;
+    float noiseTarget = 0;
+    // camera position; the camera looks down +z
+    Vector3f eye = Vector3f(278, 273, -800);
+    // JSON lines with progress, ETA, Mrays/s and per-thread utilization
+    std::string statsFile;
+    // base name of <output>.ppm, .pfm, .exr, ...
+    std::string output = "binary";
+
 private:
 };
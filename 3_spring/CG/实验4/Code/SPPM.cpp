@@ -0,0 +1,187 @@
+//
+// Stochastic progressive photon mapping.
+//
+
+#include <omp.h>
+#include "SPPM.hpp"
+
+SPPMIntegrator::SPPMIntegrator(const Scene &scene, const Camera &camera)
+    : scene(scene), camera(camera)
+{}
+
+bool SPPMIntegrator::renderImage(std::vector<Vector3f> &framebuffer, const Sampler &samplerProto,
+                                 int iterations) const
+{
+    const int width = camera.width, height = camera.height;
+    const int nPhotons = photonsPerIteration > 0 ? photonsPerIteration : width * height;
+    float r0 = initialRadius;
+    if (r0 <= 0.0f)
+        r0 = scene.bvh->WorldBound().Diagonal().norm() * 0.005f;
+
+    std::vector<SPPMPixel> pixels(width * height);
+    for (auto &pixel : pixels)
+        pixel.radius = r0;
+
+    IndependentSampler photonSamplerProto(0x5eed);
+    for (int iter = 0; iter < iterations; ++iter) {
+        // 1. visible points
+        #pragma omp parallel
+        {
+            std::unique_ptr<Sampler> sampler = samplerProto.clone();
+            #pragma omp for schedule(dynamic, 16)
+            for (int j = 0; j < height; ++j) {
+                for (int i = 0; i < width; ++i) {
+                    sampler->startPixelSample(i, j, iter);
+                    Vector2f jitter = sampler->getPixel2D();
+                    traceCameraPath(pixels[j * width + i], camera.generateRay(i + jitter.x, j + jitter.y), *sampler);
+                }
+            }
+        }
+
+        // 2. photon pass, one photon list per thread merged into the map
+        std::vector<std::vector<Photon>> threadPhotons(omp_get_max_threads());
+        #pragma omp parallel
+        {
+            std::unique_ptr<Sampler> sampler = photonSamplerProto.clone();
+            std::vector<Photon> &local = threadPhotons[omp_get_thread_num()];
+            #pragma omp for schedule(dynamic, 1024)
+            for (int k = 0; k < nPhotons; ++k) {
+                sampler->startPixelSample(k, iter, 0);
+                tracePhoton(*sampler, local);
+            }
+        }
+        std::vector<Photon> photons;
+        size_t total = 0;
+        for (auto &list : threadPhotons)
+            total += list.size();
+        photons.reserve(total);
+        for (auto &list : threadPhotons)
+            photons.insert(photons.end(), list.begin(), list.end());
+        PhotonMap map;
+        map.build(std::move(photons));
+
+        // 3. gather and shrink
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int idx = 0; idx < width * height; ++idx) {
+            SPPMPixel &pixel = pixels[idx];
+            const VisiblePoint &vp = pixel.vp;
+            if (!vp.m)
+                continue;
+            Vector3f phi;
+            int M = 0;
+            map.lookup(vp.p, pixel.radius, [&](const Photon &ph) {
+                Vector3f f = vp.m->eval(vp.wi, -ph.wi, vp.frame);
+                if (f.x > 0 || f.y > 0 || f.z > 0) {
+                    phi += f * ph.beta;
+                    ++M;
+                }
+            });
+            if (M > 0) {
+                float Nnew = pixel.N + alpha * M;
+                float Rnew = pixel.radius * std::sqrt(Nnew / (pixel.N + M));
+                pixel.tau = (pixel.tau + vp.beta * phi) * ((Rnew * Rnew) / (pixel.radius * pixel.radius));
+                pixel.N = Nnew;
+                pixel.radius = Rnew;
+            }
+            pixel.vp.m = nullptr;
+        }
+        UpdateProgress((iter + 1) / (float)iterations);
+    }
+
+    const float photonCount = (float)iterations * nPhotons;
+    for (int idx = 0; idx < width * height; ++idx) {
+        const SPPMPixel &pixel = pixels[idx];
+        framebuffer[idx] = pixel.Ld / iterations
+            + pixel.tau / (photonCount * M_PI * pixel.radius * pixel.radius);
+    }
+    return true;
+}
+
+void SPPMIntegrator::traceCameraPath(SPPMPixel &pixel, const Ray &cameraRay, Sampler &sampler) const
+{
+    Ray ray = cameraRay;
+    Vector3f beta(1.0f);
+    for (int depth = 0; depth < maxDepth; ++depth) {
+        Intersection isect = scene.intersect(ray);
+        if (!isect.happened)
+            return;
+        // emitters seen directly or through mirrors
+        if (isect.m->hasEmission())
+            pixel.Ld += beta * isect.m->getEmission();
+
+        Frame frame(isect.normal);
+        if (isect.m->getType() != MIRROR) {
+            VisiblePoint &vp = pixel.vp;
+            vp.p = isect.coords;
+            vp.wi = ray.direction;
+            vp.beta = beta;
+            vp.frame = frame;
+            vp.m = isect.m;
+            if (!isect.m->hasEmission())
+                pixel.Ld += beta * directLight(vp, sampler);
+            return;
+        }
+        BSDFSample bs = isect.m->sample(ray.direction, frame, sampler.get2D());
+        if (bs.pdf <= 0.0f)
+            return;
+        beta *= bs.weight;
+        ray = Ray(isect.coords, bs.wo);
+    }
+}
+
+Vector3f SPPMIntegrator::directLight(const VisiblePoint &vp, Sampler &sampler) const
+{
+    Intersection lightInter;
+    float lightPdf = 0.0f;
+    scene.sampleLight(vp.p, vp.frame.n, lightInter, lightPdf, sampler.get2D());
+    Vector3f toLight = lightInter.coords - vp.p;
+    float dist2 = dotProduct(toLight, toLight);
+    Vector3f dir = toLight / std::sqrt(dist2);
+    float cosLight = dotProduct(-dir, lightInter.normal);
+    float cosSurface = vp.frame.cosTheta(dir);
+    if (lightPdf <= 0.0f || cosLight <= 0.0f || cosSurface <= 0.0f)
+        return Vector3f();
+    if (!scene.visible(vp.p, lightInter.coords))
+        return Vector3f();
+    return lightInter.emit * vp.m->eval(vp.wi, dir, vp.frame) * (cosSurface * cosLight / (dist2 * lightPdf));
+}
+
+void SPPMIntegrator::tracePhoton(Sampler &sampler, std::vector<Photon> &photons) const
+{
+    Intersection pos;
+    float pdfPos = 0.0f;
+    scene.sampleLight(pos, pdfPos, sampler.get2D());
+    Vector2f u = sampler.get2D();
+    if (pdfPos <= 0.0f)
+        return;
+    Frame lightFrame(pos.normal);
+    float r = std::sqrt(u.x), phi = 2 * M_PI * u.y;
+    float cosTheta = std::sqrt(std::max(0.0f, 1.0f - u.x));
+    if (cosTheta <= 0.0f)
+        return;
+    Ray ray(pos.coords, lightFrame.toWorld(Vector3f(r * std::cos(phi), r * std::sin(phi), cosTheta)));
+    // Le cos / (pdfPos * cos / pi)
+    Vector3f beta = pos.emit * (M_PI / pdfPos);
+
+    for (int depth = 0; depth < maxDepth; ++depth) {
+        Intersection isect = scene.intersect(ray);
+        if (!isect.happened)
+            return;
+        // the first diffuse hit is direct lighting, handled at the visible points
+        if (depth > 0 && isect.m->getType() != MIRROR) {
+            Photon ph;
+            ph.p = isect.coords;
+            ph.wi = ray.direction;
+            ph.beta = beta;
+            photons.push_back(ph);
+        }
+        Frame frame(isect.normal);
+        BSDFSample bs = isect.m->sample(ray.direction, frame, sampler.get2D());
+        if (bs.pdf <= 0.0f)
+            return;
+        if (sampler.get1D() > scene.RussianRoulette)
+            return;
+        beta = beta * bs.weight / scene.RussianRoulette;
+        ray = Ray(isect.coords, bs.wo);
+    }
+}
@@ -0,0 +1,54 @@
+//
+// Stochastic progressive photon mapping (Hachisuka & Jensen 2009). Each
+// iteration traces one camera sample per pixel to its first non-delta hit,
+// shoots a batch of photons from the lights, and gathers them around the
+// visible points with radii that shrink from one iteration to the next.
+//
+
+#ifndef RAYTRACING_SPPM_H
+#define RAYTRACING_SPPM_H
+
+#include <vector>
+#include "Integrator.hpp"
+#include "PhotonMap.hpp"
+
+class SPPMIntegrator : public Integrator
+{
+public:
+    SPPMIntegrator(const Scene &scene, const Camera &camera);
+
+    // Not usable per ray: photon passes need the whole image.
+    Vector3f Li(const Ray &ray, Sampler &sampler) const override { return Vector3f(); }
+    bool renderImage(std::vector<Vector3f> &framebuffer, const Sampler &sampler, int iterations) const override;
+
+    int maxDepth = 10;
+    int photonsPerIteration = 0;   // 0: one per pixel
+    float initialRadius = 0.0f;    // 0: derived from the scene bounds
+    float alpha = 2.0f / 3.0f;     // fraction of new photons kept per iteration
+
+private:
+    struct VisiblePoint
+    {
+        Vector3f p, wi, beta;
+        Frame frame;
+        Material *m = nullptr;
+    };
+
+    struct SPPMPixel
+    {
+        VisiblePoint vp;
+        Vector3f Ld;       // sum of directly visible and directly lit radiance
+        Vector3f tau;      // accumulated, radius-corrected flux
+        float radius = 0.0f;
+        float N = 0.0f;
+    };
+
+    void traceCameraPath(SPPMPixel &pixel, const Ray &ray, Sampler &sampler) const;
+    void tracePhoton(Sampler &sampler, std::vector<Photon> &photons) const;
+    Vector3f directLight(const VisiblePoint &vp, Sampler &sampler) const;
+
+    const Scene &scene;
+    const Camera &camera;
+};
+
+#endif //RAYTRACING_SPPM_H
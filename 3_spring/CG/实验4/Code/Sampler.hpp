@@ -0,0 +1,227 @@
+//
+// Pluggable sample generators for the renderer.
+//
+
+#ifndef RAYTRACING_SAMPLER_H
+#define RAYTRACING_SAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "Vector.hpp"
+
+// Largest float below one; samples are clamped to [0, 1).
+const float OneMinusEpsilon = 0x1.fffffep-1f;
+
+inline uint64_t mixBits(uint64_t v)
+{
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= (v >> 33);
+    return v;
+}
+
+inline uint64_t hashSample(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+{
+    return mixBits(a ^ mixBits(b ^ mixBits(c ^ mixBits(d))));
+}
+
+inline uint32_t reverseBits32(uint32_t v)
+{
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+    v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+    v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+    v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+    return v;
+}
+
+// Minimal PCG32 generator; cheap to seed per pixel sample.
+class PCG32
+{
+public:
+    PCG32(uint64_t seq = 1, uint64_t seed = 0x853c49e6748fea9bULL) { setSequence(seq, seed); }
+
+    void setSequence(uint64_t seq, uint64_t seed)
+    {
+        state = 0u;
+        inc = (seq << 1u) | 1u;
+        nextUInt();
+        state += seed;
+        nextUInt();
+    }
+
+    uint32_t nextUInt()
+    {
+        uint64_t old = state;
+        state = old * 0x5851f42d4c957f2dULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+    float nextFloat() { return std::min(OneMinusEpsilon, nextUInt() * 0x1p-32f); }
+
+private:
+    uint64_t state, inc;
+};
+
+// A Sampler hands out the random numbers for one pixel sample at a time.
+// Dimensions are consumed in order (pixel jitter first), so the same call
+// sequence always lines up with the same dimensions of the point set.
+class Sampler
+{
+public:
+    virtual ~Sampler() = default;
+
+    virtual void startPixelSample(int px, int py, int sampleIndex) = 0;
+    virtual float get1D() = 0;
+    virtual Vector2f get2D() = 0;
+    // Sub-pixel jitter; always the first pair of dimensions.
+    virtual Vector2f getPixel2D() { return get2D(); }
+    virtual std::unique_ptr<Sampler> clone() const = 0;
+};
+
+// Independent uniform samples. Seeded from (pixel, sample index), so any
+// pixel sample can be regenerated regardless of thread scheduling.
+class IndependentSampler : public Sampler
+{
+public:
+    explicit IndependentSampler(uint64_t seed = 0) : seed(seed) {}
+
+    void startPixelSample(int px, int py, int sampleIndex) override
+    {
+        rng.setSequence(hashSample((uint64_t)px, (uint64_t)py, seed, 0), mixBits((uint64_t)sampleIndex));
+    }
+    float get1D() override { return rng.nextFloat(); }
+    Vector2f get2D() override { float a = rng.nextFloat(); return Vector2f(a, rng.nextFloat()); }
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<IndependentSampler>(*this); }
+
+private:
+    uint64_t seed;
+    PCG32 rng;
+};
+
+// Owen-scrambled Sobol points, padded per dimension pair: every 2D request
+// uses the first two Sobol dimensions with its own scramble and its own
+// random permutation of the sample index. Any sample count works; powers of
+// two give the best stratification. With samplesPerPixel 0 the count is
+// open-ended: indices are only permuted within [2^m, 2^(m+1)), each of
+// which is a stratified net of its own, so the first 2^m samples of a pixel
+// are stratified whenever the renderer stops.
+class SobolSampler : public Sampler
+{
+public:
+    SobolSampler(int samplesPerPixel, uint64_t seed = 0) : spp(samplesPerPixel), seed(seed) {}
+
+    void startPixelSample(int x, int y, int sampleIndex) override
+    {
+        px = x;
+        py = y;
+        index = sampleIndex;
+        dimension = 0;
+    }
+
+    float get1D() override
+    {
+        uint64_t hash = hashSample((uint64_t)px, (uint64_t)py, (uint64_t)dimension, seed);
+        ++dimension;
+        uint32_t i = permutedIndex((uint32_t)hash);
+        return toFloat(owenScramble(sobol0(i), (uint32_t)(hash >> 32)));
+    }
+
+    Vector2f get2D() override
+    {
+        uint64_t hash = hashSample((uint64_t)px, (uint64_t)py, (uint64_t)dimension, seed);
+        dimension += 2;
+        uint32_t i = permutedIndex((uint32_t)hash);
+        uint64_t seeds = mixBits(hash);
+        return Vector2f(toFloat(owenScramble(sobol0(i), (uint32_t)seeds)),
+                        toFloat(owenScramble(sobol1(i), (uint32_t)(seeds >> 32))));
+    }
+
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<SobolSampler>(*this); }
+
+private:
+    static float toFloat(uint32_t v) { return std::min(OneMinusEpsilon, v * 0x1p-32f); }
+
+    // First Sobol dimension is the van der Corput sequence.
+    static uint32_t sobol0(uint32_t i) { return reverseBits32(i); }
+
+    // Second Sobol dimension; direction numbers v_k = v_{k-1} ^ (v_{k-1} >> 1).
+    static uint32_t sobol1(uint32_t i)
+    {
+        uint32_t v = 1u << 31, r = 0;
+        for (; i; i >>= 1, v ^= v >> 1)
+            if (i & 1) r ^= v;
+        return r;
+    }
+
+    // Nested uniform scrambling approximation (Laine-Karras hash).
+    static uint32_t owenScramble(uint32_t v, uint32_t s)
+    {
+        v = reverseBits32(v);
+        v ^= v * 0x3d20adea;
+        v += s;
+        v *= (s >> 16) | 1;
+        v ^= v * 0x05526c56;
+        v ^= v * 0x53a22864;
+        return reverseBits32(v);
+    }
+
+    uint32_t permutedIndex(uint32_t hash) const
+    {
+        if (spp > 0)
+            return permutationElement((uint32_t)index, (uint32_t)spp, hash);
+        if (index == 0)
+            return 0;
+        uint32_t base = 1u << (31 - __builtin_clz((uint32_t)index));
+        return base + permutationElement((uint32_t)index - base, base, hash);
+    }
+
+    // Kensler's hashed permutation of [0, n).
+    static uint32_t permutationElement(uint32_t i, uint32_t n, uint32_t p)
+    {
+        if (n <= 1) return 0;
+        uint32_t w = n - 1;
+        w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+        do {
+            i ^= p;
+            i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= n);
+        return (i + p) % n;
+    }
+
+    int spp;
+    uint64_t seed;
+    int px = 0, py = 0, index = 0, dimension = 0;
+};
+
+enum class SamplerType { Independent, Sobol };
+
+inline std::unique_ptr<Sampler> makeSampler(SamplerType type, int spp, uint64_t seed = 0)
+{
+    if (type == SamplerType::Independent)
+        return std::make_unique<IndependentSampler>(seed);
+    return std::make_unique<SobolSampler>(spp, seed);
+}
+
+#endif //RAYTRACING_SAMPLER_H
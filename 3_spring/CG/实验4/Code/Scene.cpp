@@ -3,39 +3,90 @@
 //
 
 #include "Scene.hpp"
+#include "TraversalStats.hpp"
+#include "Telemetry.hpp"
+#include "Profiler.hpp"
 
 
 void Scene::buildBVH() {
+    PROFILE_ZONE("Scene::buildBVH");
     printf(" - Generating BVH...\n\n");
-    this->bvh = new BVHAccel(objects, 1, BVHAccel::SplitMethod::NAIVE);
+    delete this->bvh;
+    delete this->lightBVH;
+    this->bvh = new BVHAccel(objects, 1, BVHAccel::defaultSplitMethod);
+    emitAreaSum = 0;
+    for (auto object : objects)
+        if (object->hasEmit())
+            emitAreaSum += object->getArea();
+    PROFILE_ZONE("LightBVH build");
+    this->lightBVH = new LightBVH(objects);
+}
+
+void Scene::refitBVH(float rebuildRatio) {
+    PROFILE_ZONE("Scene::refitBVH");
+    bvh->refit(rebuildRatio);
+    emitAreaSum = 0;
+    for (auto object : objects)
+        if (object->hasEmit())
+            emitAreaSum += object->getArea();
+    delete this->lightBVH;
+    this->lightBVH = new LightBVH(objects);
 }
 
 Intersection Scene::intersect(const Ray &ray) const
 {
+    RT_STAT(rays);
+    telemetry::countRay();
     return this->bvh->Intersect(ray);
 }
 
-void Scene::sampleLight(Intersection &pos, float &pdf) const
+bool Scene::visible(const Vector3f &p, const Vector3f &q) const
+{
+    Vector3f d = q - p;
+    float dist = d.norm();
+    Intersection t = intersect(Ray(p, d / dist));
+    return t.distance - dist > -EPSILON;
+}
+
+void Scene::sampleLight(Intersection &pos, float &pdf, const Vector2f &u) const
 {
+    float p = u.x * emitAreaSum;
     float emit_area_sum = 0;
     for (uint32_t k = 0; k < objects.size(); ++k) {
         if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
-        }
-    }
-    float p = get_random_float() * emit_area_sum;
-    emit_area_sum = 0;
-    for (uint32_t k = 0; k < objects.size(); ++k) {
-        if (objects[k]->hasEmit()){
-            emit_area_sum += objects[k]->getArea();
+            float area = objects[k]->getArea();
+            emit_area_sum += area;
             if (p <= emit_area_sum){
-                objects[k]->Sample(pos, pdf);
+                // rescale the part of u.x inside this emitter back to [0,1)
+                float v = std::min(OneMinusEpsilon, (p - (emit_area_sum - area)) / area);
+                objects[k]->Sample(pos, pdf, Vector2f(v, u.y));
+                // chosen with probability area / emitAreaSum
+                pdf *= area / emitAreaSum;
                 break;
             }
         }
     }
 }
 
+float Scene::pdfLight([[maybe_unused]] const Intersection &lightHit) const
+{
+    // emitters are chosen by area and sampled uniformly over it, so the
+    // area pdf is the same for every point on every emitter
+    return emitAreaSum > 0.0f ? 1.0f / emitAreaSum : 0.0f;
+}
+
+void Scene::sampleLight(const Vector3f &p, const Vector3f &n, Intersection &pos, float &pdf,
+                        const Vector2f &u) const
+{
+    if (!lightBVH->sample(p, n, pos, pdf, u))
+        pdf = 0.0f;
+}
+
+float Scene::pdfLight(const Vector3f &p, const Vector3f &n, const Intersection &lightHit) const
+{
+    return lightBVH->pdf(p, n, lightHit);
+}
+
 bool Scene::trace(
         const Ray &ray,
         const std::vector<Object*> &objects,
@@ -58,85 +109,98 @@ bool Scene::trace(
 }
 
 // Implementation of Path Tracing
-Vector3f Scene::castRay(const Ray &ray, int depth) const
+Vector3f Scene::castRay(const Ray &ray, int depth, Sampler &sampler) const
 {
-    // TO DO Implement Path Tracing Algorithm here
     Intersection intersec = intersect(ray);
     if (!intersec.happened) {
         return Vector3f();
     }
+    return shade(ray, intersec, depth, sampler);
+}
 
+Vector3f Scene::shade(const Ray &ray, const Intersection &intersec, int depth, Sampler &sampler) const
+{
+    RT_STAT(pathVertices);
     // 打到光源
     if (intersec.m->hasEmission()) {
         return intersec.m->getEmission();
     }
 
+    // Switch on the material once; everything below is resolved at compile time.
+    switch(intersec.m->getType()){
+        case DIFFUSE: return shadeSurface<DIFFUSE>(ray, intersec, depth, sampler);
+        case MIRROR: return shadeSurface<MIRROR>(ray, intersec, depth, sampler);
+        case GLOSSY: return shadeSurface<GLOSSY>(ray, intersec, depth, sampler);
+    }
+    return Vector3f();
+}
+
+template <MaterialType T>
+Vector3f Scene::shadeSurface(const Ray &ray, const Intersection &intersec, int depth, Sampler &sampler) const
+{
+    const Material &m = *intersec.m;
+    const Frame frame(intersec.normal);
 
     Vector3f l_dir(0,0,0);
     Vector3f l_indir(0,0,0);
-    switch(intersec.m->getType()){
-        case DIFFUSE:{
-            // 对光源积分
-            Intersection lightInter;
-            float lightPdf = 0.0f;
 
-            sampleLight(lightInter, lightPdf);
+    // 对光源积分, weighted against the chance of the BSDF finding the same
+    // point. Delta lobes cannot be hit by a light sample at all.
+    if constexpr (T != MIRROR) {
+        Intersection lightInter;
+        float lightPdf = 0.0f;
 
-            Vector3f obj2light = lightInter.coords - intersec.coords;
-            Vector3f obj2lightDir = obj2light.normalized();
-            float obj2lightPow = obj2light.x * obj2light.x + obj2light.y * obj2light.y + obj2light.z * obj2light.z;
+        sampleLight(intersec.coords, intersec.normal, lightInter, lightPdf, sampler.get2D());
 
+        Vector3f obj2light = lightInter.coords - intersec.coords;
+        float obj2lightPow = dotProduct(obj2light, obj2light);
+        float obj2lightDist = std::sqrt(obj2lightPow);
+        Vector3f obj2lightDir = obj2light / obj2lightDist;
+        float cosLight = dotProduct(-obj2lightDir, lightInter.normal);
+        float cosSurface = frame.cosTheta(obj2lightDir);
+
+        if (cosLight > 0.0f && cosSurface > 0.0f && lightPdf > 0.0f) {
             Ray obj2lightRay(intersec.coords, obj2lightDir);
             Intersection t = intersect(obj2lightRay);
-            if (t.distance - obj2light.norm() > -EPSILON)
+            if (t.distance - obj2lightDist > -EPSILON)
             {
-                l_dir = lightInter.emit * intersec.m->eval(ray.direction, obj2lightDir, intersec.normal) 
-                    * dotProduct(obj2lightDir, intersec.normal) 
-                    * dotProduct(-obj2lightDir, lightInter.normal) 
-                    / obj2lightPow / lightPdf;
+                float lightPdfW = lightPdf * obj2lightPow / cosLight;
+                float bsdfPdf = m.template pdfBSDF<T>(ray.direction, obj2lightDir, frame);
+                l_dir = lightInter.emit * m.template evalBSDF<T>(ray.direction, obj2lightDir, frame)
+                    * (cosSurface / lightPdfW * powerHeuristic(lightPdfW, bsdfPdf));
             }
+        }
+    }
 
-            if (get_random_float() > RussianRoulette) {
-                return l_dir;
-            }
+    if (sampler.get1D() > RussianRoulette) {
+        return l_dir;
+    }
 
-            // 对其他方向积分
-            Vector3f obj2nextobjdir = intersec.m->sample(ray.direction, intersec.normal).normalized();
-            Ray obj2nextobjray(intersec.coords, obj2nextobjdir);
-            Intersection nextObjInter = intersect(obj2nextobjray);
-            if (nextObjInter.happened && !nextObjInter.m->hasEmission())
-            {
-                float pdf = intersec.m->pdf(ray.direction, obj2nextobjdir, intersec.normal);
-                if (pdf > EPSILON)
-                {
-                    l_indir = castRay(obj2nextobjray, depth + 1) 
-                        * intersec.m->eval(ray.direction, obj2nextobjdir, intersec.normal) 
-                        * dotProduct(obj2nextobjdir, intersec.normal)
-                        / pdf / RussianRoulette;
-                }
-            }           
-            break;
-        }
-        case MIRROR:{
-            if (get_random_float() > RussianRoulette) {
+    // 对其他方向积分
+    BSDFSample bs = m.template sampleBSDF<T>(ray.direction, frame, sampler.get2D());
+    if (bs.pdf <= 0.0f) {
+        return l_dir;
+    }
+    Ray obj2nextobjray(intersec.coords, bs.wo);
+    Intersection nextObjInter = intersect(obj2nextobjray);
+    if (!nextObjInter.happened) {
+        return l_dir;
+    }
+    if (nextObjInter.m->hasEmission()) {
+        // The other half of the MIS pair; after a delta lobe this is the
+        // only way the light can be seen.
+        float w = 1.0f;
+        if (!bs.isDelta) {
+            float cosLight = dotProduct(-bs.wo, nextObjInter.normal);
+            if (cosLight <= 0.0f)
                 return l_dir;
-            }
-            Vector3f obj2nextobjdir = intersec.m->sample(ray.direction, intersec.normal).normalized();
-            Ray obj2nextobjray(intersec.coords, obj2nextobjdir);
-            Intersection nextObjInter = intersect(obj2nextobjray);
-            if (nextObjInter.happened)
-            {
-                float pdf = intersec.m->pdf(ray.direction, obj2nextobjdir, intersec.normal);
-                if (pdf > EPSILON)
-                {
-                    l_indir = castRay(obj2nextobjray, depth + 1) 
-                        * intersec.m->eval(ray.direction, obj2nextobjdir, intersec.normal) 
-                        * dotProduct(obj2nextobjdir, intersec.normal)
-                        / pdf / RussianRoulette;
-                }
-            }
-            break;
+            float dist = nextObjInter.distance;
+            w = powerHeuristic(bs.pdf, pdfLight(intersec.coords, intersec.normal, nextObjInter) * dist * dist / cosLight);
         }
+        l_indir = nextObjInter.m->getEmission() * bs.weight * (w / RussianRoulette);
+    }
+    else {
+        l_indir = shade(obj2nextobjray, nextObjInter, depth + 1, sampler) * bs.weight / RussianRoulette;
     }
     return l_dir + l_indir;
-}
\ No newline at end of file
+}
@@ -11,6 +11,8 @@
 #include "AreaLight.hpp"
 #include "BVH.hpp"
 #include "Ray.hpp"
+#include "Sampler.hpp"
+#include "LightBVH.hpp"
 
 
 class Scene
@@ -26,6 +28,9 @@ public:
 
     Scene(int w, int h) : width(w), height(h)
     {}
+    ~Scene() { delete bvh; delete lightBVH; }
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
 
     void Add(Object *object) { objects.push_back(object); }
     void Add(std::unique_ptr<Light> light) { lights.push_back(std::move(light)); }
@@ -33,10 +38,27 @@ public:
     const std::vector<Object*>& get_objects() const { return objects; }
     const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
     Intersection intersect(const Ray& ray) const;
-    BVHAccel *bvh;
+    // True if nothing blocks the segment from p (on a surface) to q.
+    bool visible(const Vector3f &p, const Vector3f &q) const;
+    BVHAccel *bvh = nullptr;
     void buildBVH();
-    Vector3f castRay(const Ray &ray, int depth) const;
-    void sampleLight(Intersection &pos, float &pdf) const;
+    // After objects moved (MeshTriangle::setTransform): refits the scene
+    // BVH, see BVHAccel::refit, and rebuilds the light BVH.
+    void refitBVH(float rebuildRatio = 2.0f);
+    Vector3f castRay(const Ray &ray, int depth, Sampler &sampler) const;
+    Vector3f shade(const Ray &ray, const Intersection &hit, int depth, Sampler &sampler) const;
+    template <MaterialType T>
+    Vector3f shadeSurface(const Ray &ray, const Intersection &hit, int depth, Sampler &sampler) const;
+    // Emitters chosen by area alone, for paths that start on a light.
+    void sampleLight(Intersection &pos, float &pdf, const Vector2f &u) const;
+    // Area-measure pdf of sampleLight() returning the point `lightHit`.
+    float pdfLight(const Intersection &lightHit) const;
+    // Emitters chosen through the light BVH by their importance for the
+    // shading point (p, n); pdf is still w.r.t. area on the light.
+    void sampleLight(const Vector3f &p, const Vector3f &n, Intersection &pos, float &pdf, const Vector2f &u) const;
+    float pdfLight(const Vector3f &p, const Vector3f &n, const Intersection &lightHit) const;
+    float emitAreaSum = 0.0f;
+    LightBVH *lightBVH = nullptr;
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
                                                    const Vector3f &shadowPointOrig,
@@ -0,0 +1,208 @@
+//
+// Scene file and job list parsing.
+//
+
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include "SceneFile.hpp"
+#include "Profiler.hpp"
+
+namespace {
+
+std::string trim(const std::string &s)
+{
+    size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+    return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+}
+
+bool readVector(std::istringstream &in, Vector3f &v)
+{
+    return (bool)(in >> v.x >> v.y >> v.z);
+}
+
+std::string key(const Vector3f &v)
+{
+    std::ostringstream out;
+    out << v.x << ',' << v.y << ',' << v.z << ';';
+    return out.str();
+}
+
+}
+
+struct SceneLoader::Context {
+    Scene *scene;
+    Renderer *renderer;
+    std::string directory;
+    // names used in this file -> shared material and its cache key
+    std::map<std::string, std::pair<Material*, std::string>> materials;
+    std::set<MeshTriangle*> meshes;
+};
+
+std::unique_ptr<Scene> SceneLoader::load(const std::string &path, const std::vector<std::string> &extra,
+                                         Renderer &renderer)
+{
+    PROFILE_ZONE("load scene file");
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << path << ": cannot open scene file\n";
+        return nullptr;
+    }
+    auto scene = std::make_unique<Scene>(784, 784);
+    Context ctx;
+    ctx.scene = scene.get();
+    ctx.renderer = &renderer;
+    size_t slash = path.find_last_of('/');
+    ctx.directory = slash == std::string::npos ? "." : path.substr(0, slash);
+
+    std::string line;
+    for (int lineNo = 1; std::getline(file, line); ++lineNo) {
+        if (!statement(line, ctx)) {
+            std::cerr << path << ":" << lineNo << ": cannot parse \"" << trim(line) << "\"\n";
+            return nullptr;
+        }
+    }
+    for (const std::string &s : extra) {
+        if (!statement(s, ctx)) {
+            std::cerr << "job statement: cannot parse \"" << trim(s) << "\"\n";
+            return nullptr;
+        }
+    }
+    scene->buildBVH();
+    return scene;
+}
+
+bool SceneLoader::statement(const std::string &text, Context &ctx)
+{
+    std::string line = trim(text.substr(0, text.find('#')));
+    if (line.empty())
+        return true;
+    std::istringstream in(line);
+    std::string command;
+    in >> command;
+
+    if (command == "resolution")
+        return (bool)(in >> ctx.scene->width >> ctx.scene->height) && ctx.scene->width > 0 && ctx.scene->height > 0;
+    if (command == "fov")
+        return (bool)(in >> ctx.scene->fov);
+    if (command == "eye")
+        return readVector(in, ctx.renderer->eye);
+    if (command == "spp")
+        return (bool)(in >> ctx.renderer->spp) && ctx.renderer->spp > 0;
+
+    if (command == "material") {
+        std::string name, type, param;
+        if (!(in >> name >> type))
+            return false;
+        MaterialType t;
+        if (type == "diffuse")
+            t = DIFFUSE;
+        else if (type == "mirror")
+            t = MIRROR;
+        else if (type == "glossy")
+            t = GLOSSY;
+        else
+            return false;
+        Vector3f kd, ks, emit;
+        float ior = 1.0f, exponent = 0.0f;
+        while (in >> param) {
+            bool ok = param == "kd" ? readVector(in, kd) : param == "ks" ? readVector(in, ks) :
+                      param == "emit" ? readVector(in, emit) : param == "ior" ? (bool)(in >> ior) :
+                      param == "exponent" ? (bool)(in >> exponent) : false;
+            if (!ok)
+                return false;
+        }
+        std::ostringstream id;
+        id << type << ':' << key(kd) << key(ks) << key(emit) << ior << ',' << exponent;
+        auto &material = materials[id.str()];
+        if (!material) {
+            material = std::make_unique<Material>(t, emit);
+            material->Kd = kd;
+            material->Ks = ks;
+            material->ior = ior;
+            material->specularExponent = exponent;
+        }
+        ctx.materials[name] = { material.get(), id.str() };
+        return true;
+    }
+
+    if (command == "mesh") {
+        std::string file, materialName, param;
+        if (!(in >> file >> materialName) || !ctx.materials.count(materialName))
+            return false;
+        Vector3f translate(0.0f), scale(1.0f), xr(1, 0, 0), yr(0, 1, 0), zr(0, 0, 1);
+        while (in >> param) {
+            bool ok = param == "translate" ? readVector(in, translate) : param == "scale" ? readVector(in, scale) :
+                      param == "rotate" ? readVector(in, xr) && readVector(in, yr) && readVector(in, zr) : false;
+            if (!ok)
+                return false;
+        }
+        if (file.empty() || file[0] != '/')
+            file = ctx.directory + "/" + file;
+        const auto &material = ctx.materials[materialName];
+        std::string id = file + '|' + key(translate) + key(scale) + key(xr) + key(yr) + key(zr) + material.second;
+        auto &mesh = meshes[id];
+        if (!mesh && moveMeshes) {
+            std::string prefix = file + '|';
+            for (auto it = meshes.begin(); it != meshes.end(); ++it) {
+                const std::string &other = it->first;
+                if (it->second && !ctx.meshes.count(it->second.get()) && other.compare(0, prefix.size(), prefix) == 0 &&
+                    other.size() >= material.second.size() &&
+                    other.compare(other.size() - material.second.size(), std::string::npos, material.second) == 0) {
+                    mesh = std::move(it->second);
+                    meshes.erase(it);
+                    mesh->setTransform(translate, scale, xr, yr, zr);
+                    break;
+                }
+            }
+        }
+        if (!mesh) {
+            if (!std::ifstream(file)) {
+                std::cerr << file << ": cannot open mesh\n";
+                meshes.erase(id);
+                return false;
+            }
+            mesh = std::make_unique<MeshTriangle>(file, material.first, translate, scale, xr, yr, zr);
+        }
+        ctx.meshes.insert(mesh.get());
+        ctx.scene->Add(mesh.get());
+        return true;
+    }
+    return false;
+}
+
+bool readJobList(const std::string &path, std::vector<RenderJob> &jobs)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << path << ": cannot open job list\n";
+        return false;
+    }
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        RenderJob job;
+        std::istringstream parts(line);
+        std::string head, statement;
+        std::getline(parts, head, ';');
+        std::istringstream words(head);
+        words >> job.scene >> job.output;
+        // scene paths are relative to the job list, like mesh paths
+        if (job.scene[0] != '/')
+            job.scene = directory + job.scene;
+        if (job.output.empty()) {
+            size_t begin = job.scene.find_last_of('/') + 1, end = job.scene.find_last_of('.');
+            job.output = job.scene.substr(begin, end == std::string::npos || end < begin ? std::string::npos
+                                                                                       : end - begin);
+        }
+        while (std::getline(parts, statement, ';'))
+            job.extra.push_back(statement);
+        jobs.push_back(job);
+    }
+    return true;
+}
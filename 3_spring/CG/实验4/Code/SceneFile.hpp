@@ -0,0 +1,65 @@
+//
+// Text scene descriptions, one statement per line ('#' starts a comment):
+//
+//   resolution 784 784
+//   fov 40
+//   eye 278 273 -800
+//   spp 64
+//   material white diffuse kd 0.725 0.71 0.68
+//   material light diffuse kd 0.65 0.65 0.65 emit 47.8 38.6 31.1
+//   material chrome mirror ior 40
+//   mesh ../models/bunny/bunny.obj chrome translate 200 -60 150 scale 1500 1500 1500 rotate -1 0 0 0 1 0 0 0 -1
+//
+// Materials are diffuse, mirror or glossy with optional kd, ks, emit, ior
+// and exponent. Mesh paths are relative to the scene file; rotate takes the
+// three rows of the matrix, as MeshTriangle does.
+//
+
+#ifndef RAYTRACING_SCENEFILE_H
+#define RAYTRACING_SCENEFILE_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Scene.hpp"
+#include "Triangle.hpp"
+#include "Renderer.hpp"
+
+// Loads scene files and keeps every mesh (with its BVH) and material it has
+// built, so later scenes and frames that use the same mesh with the same
+// transform and material share it instead of loading it again.
+class SceneLoader
+{
+public:
+    // Builds the scene in `path`, then applies `extra` statements (e.g.
+    // "spp 16" or "eye 0 0 0" from a job list). Settings go into `renderer`.
+    // Returns nullptr and prints the reason on errors.
+    std::unique_ptr<Scene> load(const std::string &path, const std::vector<std::string> &extra, Renderer &renderer);
+
+    size_t cachedMeshes() const { return meshes.size(); }
+
+    // Frame sequences: a mesh that reappears with a new transform (same file
+    // and material) takes over the cached mesh and refits its BVH instead of
+    // loading and building it again. Scenes loaded earlier then see the
+    // mesh moved, so only use this when they are done with.
+    bool moveMeshes = false;
+
+private:
+    struct Context;
+    bool statement(const std::string &line, Context &ctx);
+
+    std::map<std::string, std::unique_ptr<Material>> materials;
+    std::map<std::string, std::unique_ptr<MeshTriangle>> meshes;
+};
+
+// One job per line: "<scene file> [output base] [; statement]...", e.g.
+//   cornell.scene frame000 ; eye 278 273 -800
+//   cornell.scene frame001 ; eye 268 273 -800 ; spp 32
+struct RenderJob {
+    std::string scene, output;
+    std::vector<std::string> extra;
+};
+bool readJobList(const std::string &path, std::vector<RenderJob> &jobs);
+
+#endif //RAYTRACING_SCENEFILE_H
@@ -0,0 +1,187 @@
+//
+// Batch Vector3f kernels with runtime ISA dispatch.
+//
+
+#include "Simd.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAYTRACING_X86 1
+#else
+#define RAYTRACING_X86 0
+#endif
+
+namespace simd {
+
+namespace {
+
+void accumulateScalar(Vector3f* dst, const Vector3f* src, float s, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i].x += src[i].x * s;
+        dst[i].y += src[i].y * s;
+        dst[i].z += src[i].z * s;
+    }
+}
+
+void scaleScalar(Vector3f* v, float s, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        v[i].x *= s;
+        v[i].y *= s;
+        v[i].z *= s;
+    }
+}
+
+void clamp01Scalar(Vector3f* v, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        v[i].x = std::max(0.0f, std::min(1.0f, v[i].x));
+        v[i].y = std::max(0.0f, std::min(1.0f, v[i].y));
+        v[i].z = std::max(0.0f, std::min(1.0f, v[i].z));
+    }
+}
+
+#if RAYTRACING_X86
+// Vector3f is 16 bytes with a padding lane, so an __m128 holds one vector and
+// an __m256 holds two. The padding lane is only ever multiplied or clamped,
+// which keeps it at zero.
+__attribute__((target("sse4.1")))
+void accumulateSSE41(Vector3f* dst, const Vector3f* src, float s, size_t n)
+{
+    float* d = &dst[0].x;
+    const float* a = &src[0].x;
+    __m128 vs = _mm_set1_ps(s);
+    for (size_t i = 0; i < n; ++i)
+        _mm_store_ps(d + 4 * i, _mm_add_ps(_mm_load_ps(d + 4 * i), _mm_mul_ps(_mm_load_ps(a + 4 * i), vs)));
+}
+
+__attribute__((target("sse4.1")))
+void scaleSSE41(Vector3f* v, float s, size_t n)
+{
+    float* d = &v[0].x;
+    __m128 vs = _mm_set1_ps(s);
+    for (size_t i = 0; i < n; ++i)
+        _mm_store_ps(d + 4 * i, _mm_mul_ps(_mm_load_ps(d + 4 * i), vs));
+}
+
+__attribute__((target("sse4.1")))
+void clamp01SSE41(Vector3f* v, size_t n)
+{
+    float* d = &v[0].x;
+    __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f);
+    for (size_t i = 0; i < n; ++i)
+        _mm_store_ps(d + 4 * i, _mm_min_ps(hi, _mm_max_ps(lo, _mm_load_ps(d + 4 * i))));
+}
+
+__attribute__((target("avx2,fma")))
+void accumulateAVX2(Vector3f* dst, const Vector3f* src, float s, size_t n)
+{
+    float* d = &dst[0].x;
+    const float* a = &src[0].x;
+    __m256 vs = _mm256_set1_ps(s);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm256_storeu_ps(d + 4 * i, _mm256_fmadd_ps(_mm256_loadu_ps(a + 4 * i), vs, _mm256_loadu_ps(d + 4 * i)));
+    if (i < n)
+        accumulateSSE41(dst + i, src + i, s, n - i);
+}
+
+__attribute__((target("avx2")))
+void scaleAVX2(Vector3f* v, float s, size_t n)
+{
+    float* d = &v[0].x;
+    __m256 vs = _mm256_set1_ps(s);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm256_storeu_ps(d + 4 * i, _mm256_mul_ps(_mm256_loadu_ps(d + 4 * i), vs));
+    if (i < n)
+        scaleSSE41(v + i, s, n - i);
+}
+
+__attribute__((target("avx2")))
+void clamp01AVX2(Vector3f* v, size_t n)
+{
+    float* d = &v[0].x;
+    __m256 lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm256_storeu_ps(d + 4 * i, _mm256_min_ps(hi, _mm256_max_ps(lo, _mm256_loadu_ps(d + 4 * i))));
+    if (i < n)
+        clamp01SSE41(v + i, n - i);
+}
+#endif
+
+struct Kernels {
+    ISA isa;
+    void (*accumulate)(Vector3f*, const Vector3f*, float, size_t);
+    void (*scale)(Vector3f*, float, size_t);
+    void (*clamp01)(Vector3f*, size_t);
+};
+
+ISA detectISA()
+{
+#if RAYTRACING_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return ISA::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return ISA::SSE41;
+#endif
+    return ISA::Scalar;
+}
+
+Kernels kernelsFor(ISA isa)
+{
+    isa = std::min(isa, detectISA());
+    switch (isa) {
+#if RAYTRACING_X86
+    case ISA::AVX2:
+        return {ISA::AVX2, accumulateAVX2, scaleAVX2, clamp01AVX2};
+    case ISA::SSE41:
+        return {ISA::SSE41, accumulateSSE41, scaleSSE41, clamp01SSE41};
+#endif
+    default:
+        return {ISA::Scalar, accumulateScalar, scaleScalar, clamp01Scalar};
+    }
+}
+
+Kernels initialKernels()
+{
+    ISA isa = detectISA();
+    if (const char* env = std::getenv("RT_SIMD")) {
+        if (!std::strcmp(env, "scalar")) isa = ISA::Scalar;
+        else if (!std::strcmp(env, "sse4")) isa = ISA::SSE41;
+        else if (!std::strcmp(env, "avx2")) isa = ISA::AVX2;
+    }
+    return kernelsFor(isa);
+}
+
+Kernels& kernels()
+{
+    static Kernels k = initialKernels();
+    return k;
+}
+
+}
+
+ISA activeISA() { return kernels().isa; }
+
+const char* isaName(ISA isa)
+{
+    switch (isa) {
+    case ISA::AVX2: return "avx2";
+    case ISA::SSE41: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+void setISA(ISA isa) { kernels() = kernelsFor(isa); }
+
+void accumulate(Vector3f* dst, const Vector3f* src, float s, size_t n) { kernels().accumulate(dst, src, s, n); }
+void scale(Vector3f* v, float s, size_t n) { kernels().scale(v, s, n); }
+void clamp01(Vector3f* v, size_t n) { kernels().clamp01(v, n); }
+
+}
@@ -0,0 +1,31 @@
+//
+// Batch Vector3f kernels with runtime ISA dispatch.
+//
+
+#ifndef RAYTRACING_SIMD_H
+#define RAYTRACING_SIMD_H
+
+#include <cstddef>
+#include "Vector.hpp"
+
+namespace simd {
+
+enum class ISA { Scalar, SSE41, AVX2 };
+
+// Widest instruction set supported by the running CPU. Can be lowered with
+// the RT_SIMD environment variable (scalar, sse4, avx2) for comparisons.
+ISA activeISA();
+const char* isaName(ISA isa);
+// Force a particular kernel set, clamped to what the CPU supports.
+void setISA(ISA isa);
+
+// dst[i] += src[i] * s
+void accumulate(Vector3f* dst, const Vector3f* src, float s, size_t n);
+// v[i] *= s
+void scale(Vector3f* v, float s, size_t n);
+// v[i] = clamp(v[i], 0, 1)
+void clamp01(Vector3f* v, size_t n);
+
+}
+
+#endif //RAYTRACING_SIMD_H
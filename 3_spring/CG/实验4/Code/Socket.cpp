@@ -0,0 +1,216 @@
+//
+// Blocking socket helpers.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Socket.hpp"
+
+Connection::~Connection()
+{
+    close();
+}
+
+void Connection::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+bool Connection::peerClosed() const
+{
+    pollfd p = { fd, POLLRDHUP, 0 };
+    return fd < 0 || (poll(&p, 1, 0) > 0 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR)));
+}
+
+bool Connection::fill()
+{
+    if (begin > 0) {
+        buffer.erase(buffer.begin(), buffer.begin() + begin);
+        begin = 0;
+    }
+    char chunk[1 << 16];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+        return false;
+    buffer.insert(buffer.end(), chunk, chunk + n);
+    return true;
+}
+
+bool Connection::readLine(std::string &line)
+{
+    while (true) {
+        for (size_t i = begin; i < buffer.size(); ++i)
+            if (buffer[i] == '\n') {
+                line.assign(buffer.data() + begin, i - begin);
+                begin = i + 1;
+                return true;
+            }
+        if (!fill())
+            return false;
+    }
+}
+
+bool Connection::readExact(void *data, size_t size)
+{
+    char *out = static_cast<char*>(data);
+    while (size > 0) {
+        if (begin == buffer.size() && !fill())
+            return false;
+        size_t n = std::min(size, buffer.size() - begin);
+        memcpy(out, buffer.data() + begin, n);
+        begin += n, out += n, size -= n;
+    }
+    return true;
+}
+
+bool Connection::writeAll(const void *data, size_t size)
+{
+    const char *p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool Connection::writeLine(const std::string &line)
+{
+    std::string s = line + "\n";
+    return writeAll(s.data(), s.size());
+}
+
+int listenUnix(const std::string &path)
+{
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path.c_str());
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        perror(path.c_str());
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connectUnix(const std::string &path)
+{
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(path.c_str());
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int acceptConnection(int listenFd)
+{
+    return accept(listenFd, nullptr, nullptr);
+}
+
+namespace {
+
+// Small messages go out at once. A peer on another host that vanishes
+// without closing (power loss, partition) fails the blocked read after about
+// 25 s of unanswered keepalive probes instead of the system default of over
+// two hours; a live peer answers them even while it renders a long tile.
+// Unacknowledged writes give up after 30 s.
+void tuneTcp(int fd)
+{
+    int on = 1, idle = 10, interval = 5, count = 3;
+    unsigned timeoutMs = 30000;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeoutMs, sizeof(timeoutMs));
+}
+
+}
+
+int listenTcp(int port)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+    if (fd >= 0)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        perror("listen");
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int boundPort(int listenFd)
+{
+    sockaddr_in addr{};
+    socklen_t size = sizeof(addr);
+    if (getsockname(listenFd, (sockaddr*)&addr, &size) != 0)
+        return -1;
+    return ntohs(addr.sin_port);
+}
+
+int connectTcp(const std::string &host, int port)
+{
+    addrinfo hints{}, *result = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        fprintf(stderr, "%s: unknown host\n", host.c_str());
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *a = result; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (fd < 0)
+        perror(host.c_str());
+    else
+        tuneTcp(fd);
+    return fd;
+}
+
+int acceptTcp(int listenFd)
+{
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd >= 0)
+        tuneTcp(fd);
+    return fd;
+}
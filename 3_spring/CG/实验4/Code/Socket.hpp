@@ -0,0 +1,53 @@
+//
+// Small blocking socket helpers for the render service: a buffered
+// connection that reads lines and fixed-size payloads, and listen/connect
+// for Unix domain and TCP sockets.
+//
+
+#ifndef RAYTRACING_SOCKET_H
+#define RAYTRACING_SOCKET_H
+
+#include <string>
+#include <vector>
+
+class Connection
+{
+public:
+    explicit Connection(int fd = -1) : fd(fd) {}
+    ~Connection();
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    bool valid() const { return fd >= 0; }
+    // Reads up to and excluding '\n'; false on EOF or error.
+    bool readLine(std::string &line);
+    bool readExact(void *data, size_t size);
+    // Never raises SIGPIPE; false once the peer is gone.
+    bool writeAll(const void *data, size_t size);
+    bool writeLine(const std::string &line);
+    void close();
+    // True once the peer has shut down or reset the connection; never blocks.
+    bool peerClosed() const;
+
+private:
+    bool fill();
+
+    int fd;
+    std::vector<char> buffer;
+    size_t begin = 0;
+};
+
+// Returns a listening fd, or -1 after printing the reason. An existing
+// socket file at path is replaced.
+int listenUnix(const std::string &path);
+int connectUnix(const std::string &path);
+// Accepts one connection on a listening fd, -1 on error.
+int acceptConnection(int listenFd);
+
+// TCP on all interfaces; port 0 picks a free port, see boundPort().
+int listenTcp(int port);
+int boundPort(int listenFd);
+int connectTcp(const std::string &host, int port);
+int acceptTcp(int listenFd);
+
+#endif //RAYTRACING_SOCKET_H
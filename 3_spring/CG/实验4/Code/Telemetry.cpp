@@ -0,0 +1,120 @@
+//
+// Reporter thread for the render telemetry.
+//
+
+#include <iostream>
+#include "Telemetry.hpp"
+#include "Profiler.hpp"
+
+namespace telemetry {
+
+Reporter::Reporter(long totalWork, const std::string &statsFile, double interval)
+    : totalWork(totalWork), interval(interval), start(std::chrono::steady_clock::now())
+{
+    if (!statsFile.empty() && !(stats = fopen(statsFile.c_str(), "w")))
+        perror(statsFile.c_str());
+    worker = std::thread(&Reporter::run, this);
+}
+
+Reporter::~Reporter()
+{
+    stop();
+}
+
+void Reporter::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (stopping)
+            return;
+        stopping = true;
+    }
+    cv.notify_one();
+    worker.join();
+    if (stats)
+        fclose(stats);
+}
+
+Reporter::Sample Reporter::sample() const
+{
+    Sample s;
+    s.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    s.rays = overflow.rays.load(std::memory_order_relaxed);
+    int threads = slotsUsed.load();
+    for (int i = 0; i < threads; ++i) {
+        s.rays += slots[i].rays.load(std::memory_order_relaxed);
+        s.busyNs.push_back(slots[i].busyNs.load(std::memory_order_relaxed));
+        s.live.push_back(slots[i].live.load(std::memory_order_relaxed));
+    }
+    return s;
+}
+
+void Reporter::run()
+{
+    profiler::nameThread("telemetry");
+    Sample first = sample(), prev = first;
+    std::unique_lock<std::mutex> guard(mutex);
+    while (!stopping) {
+        cv.wait_for(guard, std::chrono::duration<double>(interval));
+        Sample cur = sample();
+        if (stopping) {
+            // the final line covers the whole render
+            report(first, cur, true);
+            break;
+        }
+        report(prev, cur, false);
+        prev = cur;
+    }
+}
+
+void Reporter::report(const Sample &prev, const Sample &cur, bool final)
+{
+    long total = totalWork.load(std::memory_order_relaxed);
+    double progress = total > 0 ? std::min(1.0, done.load(std::memory_order_relaxed) / (double)total) : 0;
+    double dt = std::max(1e-9, cur.time - prev.time);
+    double mrays = (cur.rays - prev.rays) / dt * 1e-6;
+    double eta = progress > 0 ? cur.time * (1 - progress) / progress : -1;
+
+    // busy time since the previous sample over wall time, per worker that is
+    // still running
+    std::vector<double> utilization;
+    double meanUtilization = 0;
+    for (size_t i = 0; i < cur.busyNs.size(); ++i) {
+        if (!cur.live[i])
+            continue;
+        uint64_t before = i < prev.busyNs.size() ? prev.busyNs[i] : 0;
+        utilization.push_back(std::min(1.0, (cur.busyNs[i] - before) * 1e-9 / dt));
+        meanUtilization += utilization.back();
+    }
+    if (!utilization.empty())
+        meanUtilization /= utilization.size();
+
+    const int barWidth = 40;
+    int pos = barWidth * progress;
+    std::string bar(barWidth, ' ');
+    for (int i = 0; i < barWidth; ++i)
+        bar[i] = i < pos ? '=' : i == pos ? '>' : ' ';
+    char line[160];
+    if (final)
+        snprintf(line, sizeof(line), "[%s] %3d %%  %.1f s  %.2f Mrays/s  util %3.0f %%\n", bar.c_str(),
+                 (int)(progress * 100), cur.time, mrays, meanUtilization * 100);
+    else if (eta >= 0)
+        snprintf(line, sizeof(line), "[%s] %3d %%  ETA %.1f s  %.2f Mrays/s  util %3.0f %%\r", bar.c_str(),
+                 (int)(progress * 100), eta, mrays, meanUtilization * 100);
+    else
+        snprintf(line, sizeof(line), "[%s] %3d %%  ETA --  %.2f Mrays/s  util %3.0f %%\r", bar.c_str(),
+                 (int)(progress * 100), mrays, meanUtilization * 100);
+    std::cout << line << std::flush;
+
+    if (stats) {
+        fprintf(stats, "{\"time\": %.3f, \"progress\": %.4f, \"eta\": %.3f, \"rays\": %llu, \"mrays_per_s\": %.4f, "
+                       "\"final\": %s, \"utilization\": [", cur.time, progress, eta,
+                (unsigned long long)cur.rays, mrays, final ? "true" : "false");
+        for (size_t i = 0; i < utilization.size(); ++i)
+            fprintf(stats, "%s%.3f", i ? ", " : "", utilization[i]);
+        fprintf(stats, "]}\n");
+        fflush(stats);
+    }
+}
+
+}
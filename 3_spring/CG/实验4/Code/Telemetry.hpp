@@ -0,0 +1,140 @@
+//
+// Render progress and throughput without locks on the hot path. Workers
+// only touch their own cache line (rays traced, busy time) and one shared
+// relaxed atomic for finished work items; a reporter thread samples them at
+// a fixed interval for the console and an optional JSON-lines stats file.
+//
+
+#ifndef RAYTRACING_TELEMETRY_H
+#define RAYTRACING_TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace telemetry {
+
+struct alignas(64) ThreadCounters {
+    std::atomic<uint64_t> rays{0};
+    std::atomic<uint64_t> busyNs{0};
+    // held by a running thread
+    std::atomic<bool> live{false};
+};
+
+constexpr int kMaxThreads = 256;
+inline ThreadCounters slots[kMaxThreads];
+// shared by the threads that find every slot taken
+inline ThreadCounters overflow;
+// one past the highest slot ever claimed
+inline std::atomic<int> slotsUsed{0};
+
+// A thread's hold on a slot, released when the thread exits so that the
+// slot can be reused. Each held slot has a single writer, so a relaxed
+// load/store pair is enough and avoids a locked read-modify-write; only
+// the overflow slot needs fetch_add.
+class SlotClaim
+{
+public:
+    SlotClaim()
+    {
+        for (int i = 0; i < kMaxThreads; ++i) {
+            bool free = false;
+            if (!slots[i].live.load(std::memory_order_relaxed) &&
+                slots[i].live.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                slot = &slots[i];
+                for (int used = slotsUsed.load(); used <= i && !slotsUsed.compare_exchange_weak(used, i + 1);)
+                    ;
+                return;
+            }
+        }
+        slot = &overflow;
+    }
+    ~SlotClaim()
+    {
+        if (slot != &overflow)
+            slot->live.store(false, std::memory_order_release);
+    }
+
+    void add(std::atomic<uint64_t> ThreadCounters::*counter, uint64_t n)
+    {
+        std::atomic<uint64_t> &c = slot->*counter;
+        if (slot == &overflow)
+            c.fetch_add(n, std::memory_order_relaxed);
+        else
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+private:
+    ThreadCounters *slot;
+};
+
+// The calling thread's claim; each thread claims a slot on first use.
+inline SlotClaim &local()
+{
+    thread_local SlotClaim claim;
+    return claim;
+}
+
+inline void countRay() { local().add(&ThreadCounters::rays, 1); }
+
+// Adds the lifetime of the object to the thread's busy time.
+class BusyScope
+{
+public:
+    BusyScope() : start(std::chrono::steady_clock::now()) {}
+    ~BusyScope()
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        local().add(&ThreadCounters::busyNs, ns.count());
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+class Reporter
+{
+public:
+    // totalWork is in whatever unit workDone() is called with (rows, tiles).
+    Reporter(long totalWork, const std::string &statsFile = "", double interval = 0.5);
+    ~Reporter();
+
+    void workDone(long n = 1) { done.fetch_add(n, std::memory_order_relaxed); }
+    // For renders that plan their work as they go.
+    void addWork(long n) { totalWork.fetch_add(n, std::memory_order_relaxed); }
+    // Prints the final line and stops the thread.
+    void stop();
+
+private:
+    struct Sample {
+        double time;
+        uint64_t rays;
+        std::vector<uint64_t> busyNs;
+        std::vector<bool> live;
+    };
+
+    void run();
+    Sample sample() const;
+    void report(const Sample &prev, const Sample &cur, bool final);
+
+    std::atomic<long> totalWork;
+    const double interval;
+    std::atomic<long> done{0};
+    std::chrono::steady_clock::time_point start;
+    FILE *stats = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread worker;
+};
+
+}
+
+#endif //RAYTRACING_TELEMETRY_H
@@ -0,0 +1,100 @@
+//
+// Memory-mapped tiled framebuffer.
+//
+
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "TiledFramebuffer.hpp"
+#include "ImageIO.hpp"
+#include "Profiler.hpp"
+
+TiledFramebuffer::TiledFramebuffer(const std::string &path, int width, int height, int tileSize)
+    : width(width), height(height), tileSize(tileSize)
+{
+    bytes = (size_t)tilesX() * tilesY() * tileSize * tileSize * 3 * sizeof(float);
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, bytes) != 0) {
+        perror(path.c_str());
+        return;
+    }
+    // the file starts out sparse (all zeros); pages appear as tiles are touched
+    void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    data = static_cast<float*>(p);
+}
+
+TiledFramebuffer::~TiledFramebuffer()
+{
+    if (data)
+        munmap(data, bytes);
+    if (fd >= 0)
+        close(fd);
+}
+
+void TiledFramebuffer::evictRange(size_t offset, size_t size)
+{
+    // only whole pages can be dropped; pages shared with a neighbour stay
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = (offset + page - 1) / page * page, end = (offset + size) / page * page;
+    if (end <= begin)
+        return;
+    char *base = reinterpret_cast<char*>(data);
+    msync(base + begin, end - begin, MS_SYNC);
+    madvise(base + begin, end - begin, MADV_DONTNEED);
+    posix_fadvise(fd, begin, end - begin, POSIX_FADV_DONTNEED);
+}
+
+void TiledFramebuffer::evictTile(int tx, int ty)
+{
+    const size_t tileBytes = (size_t)tileSize * tileSize * 3 * sizeof(float);
+    evictRange(((size_t)ty * tilesX() + tx) * tileBytes, tileBytes);
+}
+
+bool TiledFramebuffer::writeImages(const std::string &base, float gamma)
+{
+    PROFILE_ZONE("write tiled images");
+    FILE *ppm = fopen((base + ".ppm").c_str(), "wb");
+    FILE *pfm = fopen((base + ".pfm").c_str(), "wb");
+    if (!ppm || !pfm) {
+        if (ppm) fclose(ppm);
+        if (pfm) fclose(pfm);
+        return false;
+    }
+    (void)fprintf(ppm, "P6\n%d %d\n255\n", width, height);
+    (void)fprintf(pfm, "PF\n%d %d\n-1.0\n", width, height);
+    const long pfmHeader = ftell(pfm);
+    const size_t pfmRow = 3 * sizeof(float) * width;
+
+    ToneMapper tonemap(gamma);
+    std::vector<Vector3f> row(width);
+    std::vector<unsigned char> bytesOut(3 * (size_t)width);
+    std::vector<float> floats(3 * (size_t)width);
+    bool ok = true;
+    for (int ty = 0; ty < tilesY() && ok; ++ty) {
+        int y1 = std::min(height, (ty + 1) * tileSize);
+        for (int y = ty * tileSize; y < y1 && ok; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const float *p = pixel(x, y);
+                row[x] = Vector3f(p[0], p[1], p[2]);
+                floats[3 * x] = p[0];
+                floats[3 * x + 1] = p[1];
+                floats[3 * x + 2] = p[2];
+            }
+            tonemap.apply(row.data(), bytesOut.data(), width);
+            ok = fwrite(bytesOut.data(), 1, bytesOut.size(), ppm) == bytesOut.size();
+            // PFM rows run bottom to top
+            fseek(pfm, pfmHeader + (long)(height - 1 - y) * pfmRow, SEEK_SET);
+            ok = ok && fwrite(floats.data(), sizeof(float), floats.size(), pfm) == floats.size();
+        }
+        for (int tx = 0; tx < tilesX(); ++tx)
+            evictTile(tx, ty);
+    }
+    ok = fclose(ppm) == 0 && ok;
+    return fclose(pfm) == 0 && ok;
+}
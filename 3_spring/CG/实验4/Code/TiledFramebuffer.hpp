@@ -0,0 +1,50 @@
+//
+// Accumulation buffer for images too large to keep in memory. Pixels live
+// in a memory-mapped file laid out tile by tile; a tile is paged in when a
+// worker starts writing it, and flushed and dropped from memory as soon as
+// it is finished, so only the tiles in flight are resident.
+//
+
+#ifndef RAYTRACING_TILEDFRAMEBUFFER_H
+#define RAYTRACING_TILEDFRAMEBUFFER_H
+
+#include <string>
+#include "Vector.hpp"
+
+class TiledFramebuffer
+{
+public:
+    TiledFramebuffer(const std::string &path, int width, int height, int tileSize = 64);
+    ~TiledFramebuffer();
+    TiledFramebuffer(const TiledFramebuffer&) = delete;
+    TiledFramebuffer& operator=(const TiledFramebuffer&) = delete;
+
+    bool valid() const { return data != nullptr; }
+    int tilesX() const { return (width + tileSize - 1) / tileSize; }
+    int tilesY() const { return (height + tileSize - 1) / tileSize; }
+
+    // Pixels are three packed floats; tiles are tileSize^2 pixels even at the
+    // right and bottom edges, so a tile's bytes never straddle another tile.
+    float *pixel(int x, int y) const
+    {
+        size_t tile = (size_t)(y / tileSize) * tilesX() + x / tileSize;
+        size_t inTile = (size_t)(y % tileSize) * tileSize + x % tileSize;
+        return data + 3 * (tile * tileSize * tileSize + inTile);
+    }
+
+    // Writes the tile back to the file and releases its memory.
+    void evictTile(int tx, int ty);
+    // Writes <base>.ppm and <base>.pfm one band of tiles at a time.
+    bool writeImages(const std::string &base, float gamma);
+
+    const int width, height, tileSize;
+
+private:
+    void evictRange(size_t offset, size_t size);
+
+    int fd = -1;
+    float *data = nullptr;
+    size_t bytes = 0;
+};
+
+#endif //RAYTRACING_TILEDFRAMEBUFFER_H
@@ -0,0 +1,109 @@
+//
+// Heatmap and histogram output for the traversal counters.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "TraversalStats.hpp"
+#include "ImageIO.hpp"
+
+namespace stats {
+
+namespace {
+
+// Black -> blue -> cyan -> green -> yellow -> red.
+Vector3f falseColor(float t)
+{
+    static const Vector3f stops[] = { Vector3f(0, 0, 0), Vector3f(0, 0, 1), Vector3f(0, 1, 1),
+                                      Vector3f(0, 1, 0), Vector3f(1, 1, 0), Vector3f(1, 0, 0) };
+    const int n = sizeof(stops) / sizeof(stops[0]) - 1;
+    t = std::min(std::max(t, 0.0f), 1.0f) * n;
+    int i = std::min((int)t, n - 1);
+    return lerp(stops[i], stops[i + 1], t - i);
+}
+
+float percentile(std::vector<float> values, float q)
+{
+    if (values.empty())
+        return 0;
+    size_t k = std::min(values.size() - 1, (size_t)(q * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+void writeHeatmap(const std::string &filename, const std::vector<float> &values, int width, int height)
+{
+    // the 99th percentile maps to red so a few outliers don't flatten the image
+    float scale = percentile(values, 0.99f);
+    scale = scale > 0 ? 1 / scale : 0;
+    std::vector<Vector3f> image(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+        image[i] = falseColor(values[i] * scale);
+    writePPM(filename.c_str(), image, width, height, 1.0f);
+}
+
+void writeHistogram(FILE *fp, const char *name, const std::vector<float> &values)
+{
+    const int buckets = 24;
+    std::vector<size_t> counts(buckets, 0);
+    double sum = 0;
+    float maxValue = 0;
+    for (float v : values) {
+        // bucket 0 holds [0, 1), bucket b holds [2^(b-1), 2^b)
+        int b = v < 1 ? 0 : std::min(buckets - 1, (int)std::log2(v) + 1);
+        ++counts[b];
+        sum += v;
+        maxValue = std::max(maxValue, v);
+    }
+    fprintf(fp, "%s: mean %.2f  median %.2f  p99 %.2f  max %.2f (per sample)\n", name,
+            values.empty() ? 0.0 : sum / values.size(), percentile(values, 0.5f), percentile(values, 0.99f),
+            maxValue);
+    size_t peak = *std::max_element(counts.begin(), counts.end());
+    for (int b = 0; b < buckets; ++b) {
+        if (!counts[b])
+            continue;
+        double lo = b ? std::ldexp(1.0, b - 1) : 0, hi = std::ldexp(1.0, b);
+        fprintf(fp, "  [%8.0f, %8.0f) %8zu %s\n", lo, hi, counts[b],
+                std::string(peak ? 50 * counts[b] / peak : 0, '#').c_str());
+    }
+    fprintf(fp, "\n");
+}
+
+}
+
+TraversalImage::TraversalImage(int width, int height)
+    : width(width), height(height), nodes(width * height), boxes(width * height), prims(width * height),
+      rays(width * height), vertices(width * height)
+{}
+
+void TraversalImage::record(int x, int y, const Counters &delta, int spp)
+{
+    int i = y * width + x;
+    float inv = 1.0f / spp;
+    nodes[i] = delta.nodeVisits * inv;
+    boxes[i] = delta.boxTests * inv;
+    prims[i] = delta.primTests * inv;
+    rays[i] = delta.rays * inv;
+    vertices[i] = delta.pathVertices * inv;
+}
+
+void TraversalImage::write(const std::string &prefix) const
+{
+    writeHeatmap(prefix + "_nodes.ppm", nodes, width, height);
+    writeHeatmap(prefix + "_boxes.ppm", boxes, width, height);
+    writeHeatmap(prefix + "_prims.ppm", prims, width, height);
+    writeHeatmap(prefix + "_pathlen.ppm", vertices, width, height);
+
+    FILE *fp = fopen((prefix + ".txt").c_str(), "w");
+    if (!fp)
+        return;
+    writeHistogram(fp, "rays", rays);
+    writeHistogram(fp, "node visits", nodes);
+    writeHistogram(fp, "box tests", boxes);
+    writeHistogram(fp, "primitive tests", prims);
+    writeHistogram(fp, "path vertices", vertices);
+    fclose(fp);
+}
+
+}
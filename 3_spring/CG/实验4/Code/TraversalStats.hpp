@@ -0,0 +1,70 @@
+//
+// Optional traversal instrumentation. Built with RAYTRACING_TRAVERSAL_STATS
+// (cmake -DRAYTRACING_TRAVERSAL_STATS=ON) the BVH, triangle and path code
+// bump per-thread counters; otherwise RT_STAT compiles to nothing.
+//
+
+#ifndef RAYTRACING_TRAVERSALSTATS_H
+#define RAYTRACING_TRAVERSALSTATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef RAYTRACING_TRAVERSAL_STATS
+#define RAYTRACING_TRAVERSAL_STATS 0
+#endif
+
+namespace stats {
+
+// One cache line per thread so counting never shares a line between cores.
+struct alignas(64) Counters {
+    uint64_t rays = 0;         // closest-hit queries against the scene
+    uint64_t nodeVisits = 0;   // BVH nodes whose box the ray entered
+    uint64_t boxTests = 0;     // ray/box slab tests
+    uint64_t primTests = 0;    // ray/triangle tests
+    uint64_t pathVertices = 0; // surface hits shaded by the path tracer
+
+    Counters operator-(const Counters &c) const
+    {
+        Counters d;
+        d.rays = rays - c.rays, d.nodeVisits = nodeVisits - c.nodeVisits;
+        d.boxTests = boxTests - c.boxTests, d.primTests = primTests - c.primTests;
+        d.pathVertices = pathVertices - c.pathVertices;
+        return d;
+    }
+};
+
+// The calling thread's counters. They are only ever read back by the same
+// thread (as deltas around a pixel), so there is no shared table that
+// threads could end up aliasing.
+inline Counters &local()
+{
+    thread_local Counters counters;
+    return counters;
+}
+
+// Per-pixel averages of the counters, written as false-colour heatmaps
+// (<prefix>_nodes.ppm, ...) and log2 histograms (<prefix>.txt).
+class TraversalImage
+{
+public:
+    TraversalImage(int width, int height);
+
+    void record(int x, int y, const Counters &delta, int spp);
+    void write(const std::string &prefix) const;
+
+private:
+    int width, height;
+    std::vector<float> nodes, boxes, prims, rays, vertices;
+};
+
+}
+
+#if RAYTRACING_TRAVERSAL_STATS
+#define RT_STAT(field) (++stats::local().field)
+#else
+#define RT_STAT(field) ((void)0)
+#endif
+
+#endif //RAYTRACING_TRAVERSALSTATS_H
@@ -5,11 +5,13 @@
 #include "Material.hpp"
 #include "OBJ_Loader.hpp"
 #include "Object.hpp"
+#include "Profiler.hpp"
+#include "TraversalStats.hpp"
 #include "Triangle.hpp"
 #include <cassert>
 #include <array>
 
-bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
+inline bool rayTriangleIntersect(const Vector3f& v0, const Vector3f& v1,
                           const Vector3f& v2, const Vector3f& orig,
                           const Vector3f& dir, float& tnear, float& u, float& v)
 {
@@ -50,8 +52,15 @@ public:
     Material* m;
 
     Triangle(Vector3f _v0, Vector3f _v1, Vector3f _v2, Material* _m = nullptr)
-        : v0(_v0), v1(_v1), v2(_v2), m(_m)
+        : m(_m)
     {
+        setVertices(_v0, _v1, _v2);
+    }
+
+    // Moves the triangle; the BVH above it has to be refit afterwards.
+    void setVertices(const Vector3f &_v0, const Vector3f &_v1, const Vector3f &_v2)
+    {
+        v0 = _v0, v1 = _v1, v2 = _v2;
         e1 = v1 - v0;
         e2 = v2 - v0;
         normal = normalize(crossProduct(e1, e2));
@@ -72,10 +81,12 @@ public:
     }
     Vector3f evalDiffuseColor(const Vector2f&) const override;
     Bounds3 getBounds() override;
-    void Sample(Intersection &pos, float &pdf){
-        float x = std::sqrt(get_random_float()), y = get_random_float();
+    Bounds3 clipBounds(const Bounds3 &box) override;
+    void Sample(Intersection &pos, float &pdf, const Vector2f &u){
+        float x = std::sqrt(u.x), y = u.y;
         pos.coords = v0 * (1.0f - x) + v1 * (x * (1.0f - y)) + v2 * (x * y);
         pos.normal = this->normal;
+        pos.emit = m->getEmission();
         pdf = 1.0f / area;
     }
     float getArea(){
@@ -84,6 +95,7 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    void normalCone(Vector3f &axis, float &cosTheta) override { axis = normal; cosTheta = 1; }
 };
 
 class MeshTriangle : public Object
@@ -93,8 +105,12 @@ public:
                 Vector3f Trans = Vector3f(0.0,0.0,0.0), Vector3f Scale = Vector3f(1.0,1.0,1.0), 
                 Vector3f xr = Vector3f(1.0,0,0), Vector3f yr = Vector3f(0,1.0,0),  Vector3f zr = Vector3f(0,0,1))
     {
+        PROFILE_ZONE("MeshTriangle");
         objl::Loader loader;
-        loader.LoadFile(filename);
+        {
+            PROFILE_ZONE("OBJ load");
+            loader.LoadFile(filename);
+        }
         area = 0;
         m = mt;
         assert(loader.LoadedMeshes.size() == 1);
@@ -106,6 +122,7 @@ public:
         Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
                                      -std::numeric_limits<float>::infinity(),
                                      -std::numeric_limits<float>::infinity()};
+        restVertices.reserve(mesh.Vertices.size());
         for (int i = 0; i < mesh.Vertices.size(); i += 3) {
             std::array<Vector3f, 3> face_vertices;
 
@@ -113,20 +130,13 @@ public:
                 auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
                                      mesh.Vertices[i + j].Position.Y,
                                      mesh.Vertices[i + j].Position.Z);
-                                     
-                vert.x = dotProduct(vert, xr);
-                vert.y = dotProduct(vert, yr);
-                vert.z = dotProduct(vert, zr);
-                vert = Scale*vert+Trans;
+                restVertices.push_back(vert);
+                vert = transformVertex(vert, Trans, Scale, xr, yr, zr);
                 
                 face_vertices[j] = vert;
 
-                min_vert = Vector3f(std::min(min_vert.x, vert.x),
-                                    std::min(min_vert.y, vert.y),
-                                    std::min(min_vert.z, vert.z));
-                max_vert = Vector3f(std::max(max_vert.x, vert.x),
-                                    std::max(max_vert.y, vert.y),
-                                    std::max(max_vert.z, vert.z));
+                min_vert = Vector3f::Min(min_vert, vert);
+                max_vert = Vector3f::Max(max_vert, vert);
             }
 
             triangles.emplace_back(face_vertices[0], face_vertices[1],
@@ -134,13 +144,69 @@ public:
         }
 
         bounding_box = Bounds3(min_vert, max_vert);
+        buildBVH();
+    }
 
+    // Mesh from a triangle soup, three vertices per face (generated geometry).
+    MeshTriangle(const std::vector<Vector3f> &faceVertices, Material *mt = new Material())
+    {
+        PROFILE_ZONE("MeshTriangle");
+        area = 0;
+        m = mt;
+        triangles.reserve(faceVertices.size() / 3);
+        for (size_t i = 0; i + 2 < faceVertices.size(); i += 3) {
+            triangles.emplace_back(faceVertices[i], faceVertices[i + 1], faceVertices[i + 2], mt);
+            bounding_box = Union(bounding_box, triangles.back().getBounds());
+        }
+        buildBVH();
+    }
+
+    void buildBVH()
+    {
         std::vector<Object*> ptrs;
         for (auto& tri : triangles){
             ptrs.push_back(&tri);
             area += tri.area;
         }
-        bvh = new BVHAccel(ptrs);
+        bvh = new BVHAccel(ptrs, 1, BVHAccel::defaultSplitMethod);
+    }
+
+    // The constructor's vertex transform. Each axis row sees the components
+    // already rotated by the previous rows, as it always has.
+    static Vector3f transformVertex(Vector3f vert, const Vector3f &Trans, const Vector3f &Scale,
+                                    const Vector3f &xr, const Vector3f &yr, const Vector3f &zr)
+    {
+        vert.x = dotProduct(vert, xr);
+        vert.y = dotProduct(vert, yr);
+        vert.z = dotProduct(vert, zr);
+        return Scale*vert+Trans;
+    }
+
+    // Animation: re-poses a mesh loaded from a file with a new transform and
+    // refits its BVH instead of rebuilding it (see BVHAccel::refit). The
+    // scene's BVH must be refit too, e.g. with Scene::refitBVH().
+    void setTransform(const Vector3f &Trans, const Vector3f &Scale, const Vector3f &xr, const Vector3f &yr,
+                      const Vector3f &zr, float rebuildRatio = 2.0f)
+    {
+        PROFILE_ZONE("MeshTriangle::setTransform");
+        assert(restVertices.size() == triangles.size() * 3);
+        #pragma omp parallel for
+        for (int i = 0; i < (int)triangles.size(); ++i)
+            triangles[i].setVertices(transformVertex(restVertices[i * 3], Trans, Scale, xr, yr, zr),
+                                     transformVertex(restVertices[i * 3 + 1], Trans, Scale, xr, yr, zr),
+                                     transformVertex(restVertices[i * 3 + 2], Trans, Scale, xr, yr, zr));
+        geometryChanged(rebuildRatio);
+    }
+
+    // Animation of individual vertices, three per face in the original order.
+    void setVertices(const std::vector<Vector3f> &faceVertices, float rebuildRatio = 2.0f)
+    {
+        PROFILE_ZONE("MeshTriangle::setVertices");
+        assert(faceVertices.size() == triangles.size() * 3);
+        #pragma omp parallel for
+        for (int i = 0; i < (int)triangles.size(); ++i)
+            triangles[i].setVertices(faceVertices[i * 3], faceVertices[i * 3 + 1], faceVertices[i * 3 + 2]);
+        geometryChanged(rebuildRatio);
     }
 
     bool intersect(const Ray& ray) { return true; }
@@ -203,8 +269,8 @@ public:
         return intersec;
     }
     
-    void Sample(Intersection &pos, float &pdf){
-        bvh->Sample(pos, pdf);
+    void Sample(Intersection &pos, float &pdf, const Vector2f &u){
+        bvh->Sample(pos, pdf, u);
         pos.emit = m->getEmission();
     }
     float getArea(){
@@ -213,8 +279,15 @@ public:
     bool hasEmit(){
         return m->hasEmission();
     }
+    void getEmitters(std::vector<Object*> &emitters) override {
+        if (hasEmit())
+            for (auto &tri : triangles)
+                emitters.push_back(&tri);
+    }
 
     Bounds3 bounding_box;
+    // untransformed OBJ positions, three per triangle, for setTransform()
+    std::vector<Vector3f> restVertices;
     std::unique_ptr<Vector3f[]> vertices;
     uint32_t numTriangles;
     std::unique_ptr<uint32_t[]> vertexIndex;
@@ -226,6 +299,18 @@ public:
     float area;
 
     Material* m;
+
+private:
+    void geometryChanged(float rebuildRatio)
+    {
+        bounding_box = Bounds3();
+        area = 0;
+        for (auto &tri : triangles) {
+            bounding_box = Union(bounding_box, tri.getBounds());
+            area += tri.area;
+        }
+        bvh->refit(rebuildRatio);
+    }
 };
 
 inline bool Triangle::intersect(const Ray& ray) { return true; }
@@ -237,10 +322,47 @@ inline bool Triangle::intersect(const Ray& ray, float& tnear,
 
 inline Bounds3 Triangle::getBounds() { return Union(Bounds3(v0, v1), v2); }
 
+// Clips the triangle against the six planes of box (Sutherland-Hodgman);
+// every plane adds at most one vertex.
+inline Bounds3 Triangle::clipBounds(const Bounds3 &box)
+{
+    std::array<Vector3f, 9> poly = { v0, v1, v2 }, next;
+    int n = 3;
+    for (int axis = 0; axis < 3 && n > 0; ++axis)
+        for (int side = 0; side < 2 && n > 0; ++side) {
+            float plane = side ? box.pMax[axis] : box.pMin[axis];
+            auto inside = [&](const Vector3f &p) { return side ? p[axis] <= plane : p[axis] >= plane; };
+            int m = 0;
+            for (int i = 0; i < n; ++i) {
+                const Vector3f &a = poly[i], &b = poly[(i + 1) % n];
+                if (inside(a))
+                    next[m++] = a;
+                if (inside(a) != inside(b)) {
+                    float t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    Vector3f p = lerp(a, b, t);
+                    p[axis] = plane;
+                    next[m++] = p;
+                }
+            }
+            poly = next;
+            n = m;
+        }
+    Bounds3 clipped;
+    for (int i = 0; i < n; ++i)
+        clipped = Union(clipped, poly[i]);
+    if (n == 0)
+        return clipped;
+    // rounding in lerp must not leave the box
+    clipped.pMin = Vector3f::Max(clipped.pMin, box.pMin);
+    clipped.pMax = Vector3f::Min(clipped.pMax, box.pMax);
+    return clipped;
+}
+
 inline Intersection Triangle::getIntersection(Ray ray)
 {
     Intersection inter;
 
+    RT_STAT(primTests);
     if (dotProduct(ray.direction, normal) > 0)
         return inter;
     double u, v, t_tmp = 0;
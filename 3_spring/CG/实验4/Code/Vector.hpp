@@ -9,33 +9,63 @@
 #include <cmath>
 #include <algorithm>
 
-class Vector3f {
+// Vector3f keeps its three components in the low lanes of a 16-byte aligned
+// register-sized slot. With SSE available every arithmetic operator is a
+// single packed instruction; otherwise the plain scalar code below is used.
+// Wider ISAs (AVX2) are only worth it for batches, see Simd.hpp.
+#if defined(__SSE2__) || defined(_M_X64)
+#define RAYTRACING_SIMD_SSE 1
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#else
+#define RAYTRACING_SIMD_SSE 0
+#endif
+
+class alignas(16) Vector3f {
 public:
     float x, y, z;
+private:
+    float pad = 0; // unused fourth lane
+public:
     Vector3f() : x(0), y(0), z(0) {}
     Vector3f(float xx) : x(xx), y(xx), z(xx) {}
     Vector3f(float xx, float yy, float zz) : x(xx), y(yy), z(zz) {}
-    Vector3f operator * (const float &r) const { return Vector3f(x * r, y * r, z * r); }
-    Vector3f operator / (const float &r) const { return Vector3f(x / r, y / r, z / r); }
-
-    float norm() {return std::sqrt(x * x + y * y + z * z);}
-    Vector3f normalized() {
-        float n = std::sqrt(x * x + y * y + z * z);
-        return Vector3f(x / n, y / n, z / n);
-    }
 
+#if RAYTRACING_SIMD_SSE
+    explicit Vector3f(__m128 v) { _mm_store_ps(&x, v); }
+    __m128 simd() const { return _mm_load_ps(&x); }
+
+    Vector3f operator * (const float &r) const { return Vector3f(_mm_mul_ps(simd(), _mm_set1_ps(r))); }
+    Vector3f operator / (const float &r) const { return Vector3f(_mm_mul_ps(simd(), _mm_set1_ps(1.0f / r))); }
+    Vector3f operator * (const Vector3f &v) const { return Vector3f(_mm_mul_ps(simd(), v.simd())); }
+    Vector3f operator - (const Vector3f &v) const { return Vector3f(_mm_sub_ps(simd(), v.simd())); }
+    Vector3f operator + (const Vector3f &v) const { return Vector3f(_mm_add_ps(simd(), v.simd())); }
+    Vector3f operator - () const { return Vector3f(_mm_sub_ps(_mm_setzero_ps(), simd())); }
+    Vector3f& operator += (const Vector3f &v) { _mm_store_ps(&x, _mm_add_ps(simd(), v.simd())); return *this; }
+    Vector3f& operator -= (const Vector3f &v) { _mm_store_ps(&x, _mm_sub_ps(simd(), v.simd())); return *this; }
+    Vector3f& operator *= (const Vector3f &v) { _mm_store_ps(&x, _mm_mul_ps(simd(), v.simd())); return *this; }
+    Vector3f& operator *= (const float &r) { _mm_store_ps(&x, _mm_mul_ps(simd(), _mm_set1_ps(r))); return *this; }
+    Vector3f& operator /= (const float &r) { return *this *= 1.0f / r; }
+    friend Vector3f operator * (const float &r, const Vector3f &v) { return v * r; }
+
+    static Vector3f Min(const Vector3f &p1, const Vector3f &p2) { return Vector3f(_mm_min_ps(p1.simd(), p2.simd())); }
+    static Vector3f Max(const Vector3f &p1, const Vector3f &p2) { return Vector3f(_mm_max_ps(p1.simd(), p2.simd())); }
+#else
+    Vector3f operator * (const float &r) const { return Vector3f(x * r, y * r, z * r); }
+    Vector3f operator / (const float &r) const { float inv = 1.0f / r; return Vector3f(x * inv, y * inv, z * inv); }
     Vector3f operator * (const Vector3f &v) const { return Vector3f(x * v.x, y * v.y, z * v.z); }
     Vector3f operator - (const Vector3f &v) const { return Vector3f(x - v.x, y - v.y, z - v.z); }
     Vector3f operator + (const Vector3f &v) const { return Vector3f(x + v.x, y + v.y, z + v.z); }
     Vector3f operator - () const { return Vector3f(-x, -y, -z); }
     Vector3f& operator += (const Vector3f &v) { x += v.x, y += v.y, z += v.z; return *this; }
+    Vector3f& operator -= (const Vector3f &v) { x -= v.x, y -= v.y, z -= v.z; return *this; }
+    Vector3f& operator *= (const Vector3f &v) { x *= v.x, y *= v.y, z *= v.z; return *this; }
+    Vector3f& operator *= (const float &r) { x *= r, y *= r, z *= r; return *this; }
+    Vector3f& operator /= (const float &r) { return *this *= 1.0f / r; }
     friend Vector3f operator * (const float &r, const Vector3f &v)
     { return Vector3f(v.x * r, v.y * r, v.z * r); }
-    friend std::ostream & operator << (std::ostream &os, const Vector3f &v)
-    { return os << v.x << ", " << v.y << ", " << v.z; }
-    double       operator[](int index) const;
-    double&      operator[](int index);
-
 
     static Vector3f Min(const Vector3f &p1, const Vector3f &p2) {
         return Vector3f(std::min(p1.x, p2.x), std::min(p1.y, p2.y),
@@ -46,10 +76,26 @@ public:
         return Vector3f(std::max(p1.x, p2.x), std::max(p1.y, p2.y),
                        std::max(p1.z, p2.z));
     }
+#endif
+
+    float norm() const {return std::sqrt(x * x + y * y + z * z);}
+    float norm2() const {return x * x + y * y + z * z;}
+    Vector3f normalized() const {
+        float invLen = 1.0f / std::sqrt(x * x + y * y + z * z);
+        return *this * invLen;
+    }
+
+    friend std::ostream & operator << (std::ostream &os, const Vector3f &v)
+    { return os << v.x << ", " << v.y << ", " << v.z; }
+    double       operator[](int index) const;
+    float&       operator[](int index);
 };
 inline double Vector3f::operator[](int index) const {
     return (&x)[index];
 }
+inline float& Vector3f::operator[](int index) {
+    return (&x)[index];
+}
 
 
 class Vector2f
@@ -66,27 +112,42 @@ public:
 inline Vector3f lerp(const Vector3f &a, const Vector3f& b, const float &t)
 { return a * (1 - t) + b * t; }
 
+inline float dotProduct(const Vector3f &a, const Vector3f &b)
+{
+#if RAYTRACING_SIMD_SSE && defined(__SSE4_1__)
+    return _mm_cvtss_f32(_mm_dp_ps(a.simd(), b.simd(), 0x71));
+#else
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+#endif
+}
+
 inline Vector3f normalize(const Vector3f &v)
 {
-    float mag2 = v.x * v.x + v.y * v.y + v.z * v.z;
+    float mag2 = dotProduct(v, v);
     if (mag2 > 0) {
         float invMag = 1 / sqrtf(mag2);
-        return Vector3f(v.x * invMag, v.y * invMag, v.z * invMag);
+        return v * invMag;
     }
 
     return v;
 }
 
-inline float dotProduct(const Vector3f &a, const Vector3f &b)
-{ return a.x * b.x + a.y * b.y + a.z * b.z; }
-
 inline Vector3f crossProduct(const Vector3f &a, const Vector3f &b)
 {
+#if RAYTRACING_SIMD_SSE
+    // (a.yzx * b.zxy) - (a.zxy * b.yzx), written with two shuffles per operand
+    __m128 va = a.simd(), vb = b.simd();
+    __m128 a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(va, b_yzx), _mm_mul_ps(a_yzx, vb));
+    return Vector3f(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
     return Vector3f(
             a.y * b.z - a.z * b.y,
             a.z * b.x - a.x * b.z,
             a.x * b.y - a.y * b.x
     );
+#endif
 }
 
 
@@ -0,0 +1,96 @@
+//
+// Micro-benchmark for the Vector3f math layer: compares the SIMD Vector3f
+// against a plain scalar copy of the original class, and times the batch
+// kernels of Simd.hpp for every ISA the CPU supports.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "Vector.hpp"
+#include "Simd.hpp"
+
+namespace {
+
+struct ScalarVec {
+    float x, y, z;
+    ScalarVec() : x(0), y(0), z(0) {}
+    ScalarVec(float xx, float yy, float zz) : x(xx), y(yy), z(zz) {}
+    ScalarVec operator * (const float &r) const { return ScalarVec(x * r, y * r, z * r); }
+    ScalarVec operator * (const ScalarVec &v) const { return ScalarVec(x * v.x, y * v.y, z * v.z); }
+    ScalarVec operator + (const ScalarVec &v) const { return ScalarVec(x + v.x, y + v.y, z + v.z); }
+    ScalarVec operator - (const ScalarVec &v) const { return ScalarVec(x - v.x, y - v.y, z - v.z); }
+    ScalarVec normalized() const {
+        float n = std::sqrt(x * x + y * y + z * z);
+        return ScalarVec(x / n, y / n, z / n);
+    }
+};
+inline float dot(const ScalarVec &a, const ScalarVec &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline ScalarVec cross(const ScalarVec &a, const ScalarVec &b)
+{ return ScalarVec(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+// Keeps results alive without the optimizer folding the loops away.
+volatile float sink;
+
+template <typename F>
+double nsPerOp(size_t ops, int reps, F&& f)
+{
+    double best = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count() / ops);
+    }
+    return best;
+}
+
+template <typename V, typename Dot, typename Cross>
+void runOps(const char* name, const std::vector<V>& a, const std::vector<V>& b, std::vector<V>& out,
+            Dot dot, Cross cross)
+{
+    size_t n = a.size();
+    double madd = nsPerOp(n, 5, [&] { for (size_t i = 0; i < n; ++i) out[i] = a[i] * b[i] + a[i] * 0.5f; sink = out[n / 2].x; });
+    double dp = nsPerOp(n, 5, [&] { float s = 0; for (size_t i = 0; i < n; ++i) s += dot(a[i], b[i]); sink = s; });
+    double cp = nsPerOp(n, 5, [&] { for (size_t i = 0; i < n; ++i) out[i] = cross(a[i], b[i]); sink = out[n / 2].y; });
+    double nm = nsPerOp(n, 5, [&] { for (size_t i = 0; i < n; ++i) out[i] = (a[i] - b[i]).normalized(); sink = out[n / 2].z; });
+    printf("%-8s  mul-add %6.3f  dot %6.3f  cross %6.3f  normalized %6.3f  (ns/op)\n", name, madd, dp, cp, nm);
+}
+
+}
+
+int main()
+{
+    const size_t n = 1 << 20;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+    std::vector<ScalarVec> sa(n), sb(n), so(n);
+    std::vector<Vector3f> va(n), vb(n), vo(n);
+    for (size_t i = 0; i < n; ++i) {
+        sa[i] = ScalarVec(dist(rng), dist(rng), dist(rng));
+        sb[i] = ScalarVec(dist(rng), dist(rng), dist(rng));
+        va[i] = Vector3f(sa[i].x, sa[i].y, sa[i].z);
+        vb[i] = Vector3f(sb[i].x, sb[i].y, sb[i].z);
+    }
+
+    printf("Vector3f (%zu ops per measurement, best of 5)\n", n);
+    runOps("scalar", sa, sb, so, dot, cross);
+    runOps(RAYTRACING_SIMD_SSE ? "sse" : "fallback", va, vb, vo, dotProduct, crossProduct);
+
+    printf("\nBatch kernels (detected: %s)\n", simd::isaName(simd::activeISA()));
+    simd::ISA detected = simd::activeISA();
+    for (simd::ISA isa : {simd::ISA::Scalar, simd::ISA::SSE41, simd::ISA::AVX2}) {
+        if (isa > detected)
+            break;
+        simd::setISA(isa);
+        double acc = nsPerOp(n, 5, [&] { simd::accumulate(vo.data(), va.data(), 0.25f, n); sink = vo[n / 2].x; });
+        double scl = nsPerOp(n, 5, [&] { simd::scale(vo.data(), 0.999f, n); sink = vo[n / 2].x; });
+        double clp = nsPerOp(n, 5, [&] { simd::clamp01(vo.data(), n); sink = vo[n / 2].x; });
+        printf("%-8s  accumulate %6.3f  scale %6.3f  clamp01 %6.3f  (ns/vector)\n",
+               simd::isaName(isa), acc, scl, clp);
+    }
+    simd::setISA(detected);
+    return 0;
+}
@@ -28,11 +28,21 @@ inline  bool solveQuadratic(const float &a, const float &b, const float &c, floa
     return true;
 }
 
+// Power heuristic (beta = 2) weight for a sample drawn from the strategy
+// with pdf f when the other strategy has pdf g.
+inline float powerHeuristic(float f, float g)
+{
+    if (std::isinf(f)) return 1.0f;
+    float f2 = f * f, g2 = g * g;
+    return f2 + g2 > 0.0f ? f2 / (f2 + g2) : 0.0f;
+}
+
 inline float get_random_float()
 {
+    // one generator per thread; a shared engine is a data race under OpenMP
     static std::random_device dev;
-    static std::mt19937 rng(dev());
-    static std::uniform_real_distribution<float> dist(0.f, 1.f); // distribution in range [1, 6]
+    thread_local std::mt19937 rng(dev());
+    thread_local std::uniform_real_distribution<float> dist(0.f, 1.f);
 
     return dist(rng);
 }
@@ -1,17 +1,61 @@
 #include "Renderer.hpp"
 #include "Scene.hpp"
+#include "SceneFile.hpp"
+#include "RenderService.hpp"
+#include "Distributed.hpp"
 #include "Triangle.hpp"
 #include "Sphere.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
+#include "Profiler.hpp"
 #include <chrono>
+#include <sstream>
 
-// In the main function of the program, we create the scene (create objects and
-// lights) as well as set the options for the render (image width and height,
-// maximum recursion depth, field-of-view, etc.). We then call the render
-// function().
-int main(int argc, char** argv)
+// Command line settings that override whatever a scene file sets.
+struct Options {
+    int spp = 0, threads = 0, tileSize = 0;
+    float timeBudget = 0, noiseTarget = 0;
+    std::string output;
+
+    void apply(Renderer &r) const
+    {
+        if (spp > 0) r.spp = spp;
+        if (threads > 0) r.threads = threads;
+        if (tileSize > 0) r.tileSize = tileSize;
+        if (timeBudget > 0) r.timeBudget = timeBudget;
+        if (noiseTarget > 0) r.noiseTarget = noiseTarget;
+    }
+};
+
+// The whole of text as a number, checked the way scene file values are.
+template <typename T>
+bool parseNumber(const char *text, T &value)
+{
+    std::istringstream in(text);
+    return (in >> value) && (in >> std::ws).eof();
+}
+
+void timedRender(Renderer &r, const Scene &scene)
+{
+    auto start = std::chrono::system_clock::now();
+    {
+        PROFILE_ZONE("render");
+        r.Render(scene);
+    }
+    auto stop = std::chrono::system_clock::now();
+
+    std::cout << "Render complete: \n";
+    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << " hours\n";
+    std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
+    std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
+}
+
+// The scene this program was written for: the Cornell box with a mirror
+// bunny and tall box (scenes/cornell.scene describes the same scene).
+void renderBuiltinScene(Renderer &r)
 {
+    // the meshes have to outlive the zone, so it is recorded by hand
+    uint64_t loadBegin = profiler::nowNs();
 
     // Change the definition here to change resolution
     Scene scene(784, 784);
@@ -48,17 +92,176 @@ int main(int argc, char** argv)
     scene.Add(&light_);
 
     scene.buildBVH();
+    if (profiler::enabled)
+        profiler::record("load scene", loadBegin, profiler::nowNs(), -1);
 
-    Renderer r;
+    timedRender(r, scene);
+}
 
-    auto start = std::chrono::system_clock::now();
-    r.Render(scene);
-    auto stop = std::chrono::system_clock::now();
+// Renders every job of a job list (or the single scene file) with one
+// SceneLoader, so meshes and their BVHs are loaded once per process.
+int renderJobs(const std::vector<RenderJob> &jobs, const Renderer &defaults, const Options &options)
+{
+    SceneLoader loader;
+    // each scene is rendered before the next is loaded
+    loader.moveMeshes = true;
+    int failed = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const RenderJob &job = jobs[i];
+        std::cout << "Job " << i + 1 << "/" << jobs.size() << ": " << job.scene << " -> " << job.output << "\n";
+        Renderer r = defaults;
+        std::unique_ptr<Scene> scene = loader.load(job.scene, job.extra, r);
+        if (!scene) {
+            ++failed;
+            continue;
+        }
+        options.apply(r);
+        r.output = job.output;
+        timedRender(r, *scene);
+    }
+    std::cout << jobs.size() - failed << " of " << jobs.size() << " jobs rendered, "
+              << loader.cachedMeshes() << " meshes loaded\n";
+    return failed ? 1 : 0;
+}
 
-    std::cout << "Render complete: \n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << " hours\n";
-    std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
-    std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
+// In the main function of the program, we create the scene (create objects and
+// lights) as well as set the options for the render (image width and height,
+// maximum recursion depth, field-of-view, etc.). We then call the render
+// function().
+//
+// ./RayTracing [options] [words]                 the built-in scene below
+// ./RayTracing [options] [words] file.scene      a scene file (see SceneFile.hpp)
+// ./RayTracing [options] [words] --jobs list     every job in a job list
+// ./RayTracing [--threads N] --serve SOCKET       render daemon (RenderService.hpp)
+// ./RayTracing [--output BASE] --submit SOCKET "render file.scene spp 16"
+// ./RayTracing [options] --coordinate PORT [--workers N] file.scene
+//                                                 tiles rendered by worker
+// ./RayTracing [--threads N] --worker HOST:PORT    processes (Distributed.hpp)
+//
+// options: --spp N, --threads N, --tile N (rows per block, or out-of-core
+// tile edge), --time SECONDS and --noise RELATIVE_ERROR (progressive until
+// the time is used up or every row block is below the error; see
+// Renderer.hpp), --output BASE (output name; a prefix for job outputs)
+int main(int argc, char** argv)
+{
+    Renderer r;
+    Options options;
+    std::string sceneFile, jobFile, serveSocket, submitSocket, request, workerAddress;
+    int coordinatePort = -1, localWorkers = 0;
+    // words: [bdpt|sppm|guided|restir|irrcache] [denoise] [ooc] [stats] [trace]
+    // [lazy|sbvh] [treelets|quantized] select the bidirectional, photon mapping,
+    // path guiding, resampled direct lighting or irradiance cached integrator,
+    // optionally the denoiser, and an out-of-core framebuffer for images that
+    // do not fit in memory; stats writes live render telemetry to
+    // render_stats.jsonl, trace records profiling zones into trace.json
+    // (chrome://tracing), lazy splits BVH nodes over many triangles only once
+    // rays reach them, sbvh builds BVHs with spatial splits, and treelets or
+    // quantized traverse a cache-friendly flat copy of each BVH
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc, ok = true;
+        if (arg == "bdpt")
+            r.mode = RenderMode::BDPT;
+        else if (arg == "sppm")
+            r.mode = RenderMode::SPPM;
+        else if (arg == "guided")
+            r.mode = RenderMode::Guided;
+        else if (arg == "restir")
+            r.mode = RenderMode::ReSTIR;
+        else if (arg == "irrcache")
+            r.mode = RenderMode::IrradianceCache;
+        else if (arg == "denoise")
+            r.denoise = true;
+        else if (arg == "ooc")
+            r.outOfCore = true;
+        else if (arg == "stats")
+            r.statsFile = "render_stats.jsonl";
+        else if (arg == "trace")
+            profiler::enabled = true;
+        else if (arg == "lazy")
+            BVHAccel::lazyBuildThreshold = 256;
+        else if (arg == "sbvh")
+            BVHAccel::defaultSplitMethod = BVHAccel::SplitMethod::SBVH;
+        else if (arg == "treelets")
+            BVHAccel::defaultLayout = BVHAccel::NodeLayout::Treelet;
+        else if (arg == "quantized")
+            BVHAccel::defaultLayout = BVHAccel::NodeLayout::QuantizedTreelet;
+        else if (arg == "--spp" && hasValue)
+            ok = parseNumber(argv[++i], options.spp);
+        else if (arg == "--threads" && hasValue)
+            ok = parseNumber(argv[++i], options.threads);
+        else if (arg == "--tile" && hasValue)
+            ok = parseNumber(argv[++i], options.tileSize);
+        else if (arg == "--time" && hasValue)
+            ok = parseNumber(argv[++i], options.timeBudget);
+        else if (arg == "--noise" && hasValue)
+            ok = parseNumber(argv[++i], options.noiseTarget);
+        else if (arg == "--output" && hasValue)
+            options.output = argv[++i];
+        else if (arg == "--jobs" && hasValue)
+            jobFile = argv[++i];
+        else if (arg == "--serve" && hasValue)
+            serveSocket = argv[++i];
+        else if (arg == "--submit" && i + 2 < argc) {
+            submitSocket = argv[++i];
+            request = argv[++i];
+        }
+        else if (arg == "--coordinate" && hasValue)
+            ok = parseNumber(argv[++i], coordinatePort);
+        else if (arg == "--workers" && hasValue)
+            ok = parseNumber(argv[++i], localWorkers);
+        else if (arg == "--worker" && hasValue)
+            workerAddress = argv[++i];
+        else if (arg[0] != '-')
+            sceneFile = arg;
+        else {
+            std::cerr << "unknown option " << arg << "\n";
+            return 1;
+        }
+        if (!ok) {
+            std::cerr << arg << ": expected a number, got \"" << argv[i] << "\"\n";
+            return 1;
+        }
+    }
+
+    profiler::nameThread("main");
+    int status = 0;
+    if (!serveSocket.empty())
+        status = RenderService(serveSocket, options.threads).run();
+    else if (!submitSocket.empty())
+        status = submitRender(submitSocket, request, options.output.empty() ? "binary" : options.output);
+    else if (!workerAddress.empty())
+        status = runRenderWorker(workerAddress, options.threads);
+    else if (coordinatePort >= 0) {
+        if (sceneFile.empty()) {
+            std::cerr << "--coordinate needs a scene file\n";
+            return 1;
+        }
+        std::vector<std::string> extra;
+        if (options.spp > 0)
+            extra.push_back("spp " + std::to_string(options.spp));
+        status = coordinateRender(sceneFile, extra, options.output.empty() ? "binary" : options.output,
+                                  coordinatePort, localWorkers, options.tileSize);
+    }
+    else if (!jobFile.empty() || !sceneFile.empty()) {
+        std::vector<RenderJob> jobs;
+        if (!jobFile.empty() && !readJobList(jobFile, jobs))
+            return 1;
+        if (!sceneFile.empty())
+            jobs.push_back({ sceneFile, "binary", {} });
+        for (RenderJob &job : jobs)
+            job.output = jobFile.empty() ? (options.output.empty() ? job.output : options.output)
+                                         : options.output + job.output;
+        status = renderJobs(jobs, r, options);
+    }
+    else {
+        options.apply(r);
+        if (!options.output.empty())
+            r.output = options.output;
+        renderBuiltinScene(r);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    if (profiler::enabled && !profiler::writeChromeTrace("trace.json"))
+        std::cerr << "failed to write trace.json\n";
+    return status;
+}